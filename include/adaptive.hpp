@@ -0,0 +1,22 @@
+#pragma once
+
+#include "sph.hpp"
+
+// Adaptive resolution. Every params.adaptEvery steps, each awake fluid
+// particle is classified by its density and its distance to the walls,
+// which are the domain edges, the obstacles and any boundary particle
+// within the kernel support:
+//
+//   split  below splitDensity*restDens or within splitDistance of a wall:
+//          replaced by two particles of the next level, side by side in a
+//          random direction
+//   merge  above mergeDensity*restDens and beyond 2*splitDistance of every
+//          wall: joined with the nearest mergeable particle of its level
+//          within its smoothing length into one of the level above
+//
+// Both conserve mass and momentum. Splitting stops at params.adaptLevels
+// and at the store capacity. Particles are visited in index order on one
+// thread, so the result does not depend on the pool size. Runs at the end
+// of a step on that step's grid and compacts the store afterwards. No-op
+// unless params.adaptLevels > 0.
+void AdaptResolution(Simulation& sim);
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for scratch memory that lives at most one solver step.
+// Pieces come off one block in order and are all freed together by
+// reset(). A step that needs more than the block holds takes the rest
+// from the heap in extra blocks, and the next reset merges them into one
+// block of the combined size. Once the largest step has run, steps make
+// no heap allocations. Nothing is destroyed, so only trivially
+// destructible types belong here.
+class Arena
+{
+public:
+	Arena() = default;
+	~Arena();
+
+	Arena(Arena&& other) noexcept;
+	Arena& operator=(Arena&& other) noexcept;
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t bytes, size_t align);
+
+	// count uninitialized Ts
+	template<class T>
+	T* allocate(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	// count copies of value
+	template<class T>
+	T* allocate(size_t count, const T& value)
+	{
+		T* items = allocate<T>(count);
+		for (size_t i = 0; i < count; i++) new (items + i) T(value);
+		return items;
+	}
+
+	// Frees everything, keeping one block as large as all of it was
+	void reset();
+
+	size_t capacity() const { return m_size; }	// bytes of the main block
+	size_t used() const { return m_used + m_extraBytes; }
+
+private:
+	friend class ArenaScope;
+
+	char* m_block = nullptr;
+	size_t m_size = 0, m_used = 0;
+	std::vector<void*> m_extra;		// blocks taken since the last reset
+	size_t m_extraBytes = 0;
+	unsigned m_scopes = 0;			// open ArenaScopes
+};
+
+// Scratch arena of the calling thread, for code that runs on pool workers
+// or outside any simulation step. Take memory from it only inside an
+// ArenaScope.
+Arena& ThreadArena();
+
+// Closing the outermost scope of an arena resets it, so memory taken
+// inside nested scopes lives until the outermost one ends
+class ArenaScope
+{
+public:
+	explicit ArenaScope(Arena& arena) : m_arena(arena) { m_arena.m_scopes++; }
+	~ArenaScope() { if (--m_arena.m_scopes == 0) m_arena.reset(); }
+
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+	Arena& m_arena;
+};
+
+// Makes room for at least n items of a buffer that persists across steps,
+// growing geometrically like push_back does. Sized with assign() to a
+// slowly growing count, it would otherwise reallocate whenever that grows.
+template<class T>
+void GrowCapacity(std::vector<T>& buffer, size_t n)
+{
+	if (n > buffer.capacity()) buffer.reserve(std::max(n, 2 * buffer.capacity()));
+}
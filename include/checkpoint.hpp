@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compact binary solver checkpoint, little-endian:
+//
+//   CheckpointHeader
+//   CheckpointParticle[particleCount]
+//   CheckpointEmitter[emitterCount], in scene order
+//
+// The file is written next to its destination, synced and renamed into
+// place, so a crash or power loss while saving leaves the previous
+// checkpoint intact.
+
+const static uint32_t CHECKPOINT_VERSION = 3;
+
+#pragma pack(push, 1)
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t particleSize;
+	uint32_t emitterCount;
+	uint64_t particleCount;
+
+	// integrator state
+	uint64_t stepCount;
+	double simTime;
+	float dt;
+
+	// random generator state
+	uint64_t rngState;
+
+	// parameters the neighbor structure is derived from; a checkpoint
+	// only restores into a build that agrees on them
+	float h;
+	float support;
+	double viewWidth;	// as SimParams holds them, so they compare exactly
+	double viewHeight;
+	uint32_t padding;
+};
+
+struct CheckpointParticle
+{
+	double x[2], v[2], f[2];
+	float rho, p;
+	uint32_t flags;
+	uint32_t quietSteps;	// steps below the sleep thresholds, see UpdateSleep
+};
+
+// Running state of an emitter; its shape and rate come from the scene
+struct CheckpointEmitter
+{
+	uint64_t emitted;
+	uint64_t cursor;
+	double pending;
+};
+#pragma pack(pop)
+
+const static uint32_t CHECKPOINT_BOUNDARY = 1;
+const static uint32_t CHECKPOINT_LEVEL_SHIFT = 8;	// resolution level in bits 8-15
+
+bool SaveCheckpoint(const std::string& path, const CheckpointHeader& header,
+	const std::vector<CheckpointParticle>& particles, const std::vector<CheckpointEmitter>& emitters, std::string& error);
+
+// Maps a checkpoint read-only; particles() and emitters() point into the
+// mapping
+class CheckpointReader
+{
+public:
+	CheckpointReader() = default;
+	~CheckpointReader();
+
+	// owns the mapping, so copies would unmap it twice
+	CheckpointReader(const CheckpointReader&) = delete;
+	CheckpointReader& operator=(const CheckpointReader&) = delete;
+
+	bool open(const std::string& path, std::string& error);
+	void close();
+
+	const CheckpointHeader& header() const { return m_header; }
+	const CheckpointParticle* particles() const { return m_particles; }
+	const CheckpointEmitter* emitters() const { return m_emitters; }
+
+private:
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+	CheckpointHeader m_header;
+	const CheckpointParticle* m_particles = nullptr;
+	const CheckpointEmitter* m_emitters = nullptr;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "sph.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Domain decomposition across processes. The domain is cut along x into one
+// slab per rank, and each process stores and advances only the particles of
+// its slab. Every step a rank
+//
+//   - hands the particles that left its slab to the neighbor rank,
+//   - copies its particles within the kernel support (2*H) of a border to
+//     that neighbor, which appends them as halos: read-only particles after
+//     its own, see Simulation::haloCount,
+//   - after the density pass sends the new densities and pressures of those
+//     particles, so the halos are current for the forces.
+//
+// Ranks only talk to their two neighbors, over connected stream sockets.
+// Every rebalanceEvery steps each pair of neighbors compares the CPU time
+// their passes took and moves the border between them into the busier slab,
+// which hands over the particles on its side. Slabs never get narrower
+// than two supports, so halos always come from the next rank only.
+//
+// Emitters, sinks, adaptivity and periodic x axes are not supported; the
+// caller clears or rejects them.
+
+struct Slab
+{
+	unsigned rank = 0, ranks = 1;
+	double left, right;					// owned x range [left, right)
+	int leftLink = -1, rightLink = -1;	// sockets to the neighbor ranks, -1 at the ends
+	unsigned rebalanceEvery = 50;		// steps, 0 never
+
+	// running state
+	double load = 0.0;					// CPU seconds in the passes since the last rebalance
+	std::vector<uint32_t> haloLeft, haloRight;	// own particles copied to the neighbors this step
+	size_t haloFromLeft = 0;			// halos received from the left, stored first
+	uint64_t migrated = 0;				// particles handed over so far
+	uint64_t rebalances = 0;			// borders moved so far
+};
+
+// ranks - 1 borders that split the fluid of sim into slabs of equal particle
+// counts, at least two kernel supports apart. Every rank computes the same.
+std::vector<double> SlabBorders(const Simulation& sim, unsigned ranks);
+
+// Removes the particles outside [slab.left, slab.right)
+void KeepSlab(Simulation& sim, const Slab& slab);
+
+// One solver step of the slab, in lockstep with the neighbor ranks. On a
+// failed link returns false with error; the simulation is then unusable.
+bool StepSlab(Simulation& sim, Slab& slab, std::string& error);
+
+// Removes the halos, leaving the owned particles
+void DropHalos(Simulation& sim);
+
+// Length-prefixed messages over a stream socket
+bool SendMessage(int fd, const std::vector<uint8_t>& message, std::string& error);
+bool ReceiveMessage(int fd, std::vector<uint8_t>& message, std::string& error);
+
+// Appends particles [begin, end) of sim to message, and the particles in
+// message to sim
+void PackParticles(const Simulation& sim, size_t begin, size_t end, std::vector<uint8_t>& message);
+void UnpackParticles(const std::vector<uint8_t>& message, size_t offset, Simulation& sim);
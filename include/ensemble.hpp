@@ -0,0 +1,66 @@
+#pragma once
+
+#include "neighbor_grid.hpp"
+#include "obstacles.hpp"
+#include "sph.hpp"
+#include "thread_pool.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Scene;
+
+// Many independent copies of one small scene advanced together. All
+// members live in one structure of arrays, one member after another, and
+// every pass runs once over all of them, so a step costs one neighbor
+// build and four parallel loops however many members there are.
+//
+// For the neighbor search each member is shifted onto its own tile, with
+// a gap of two cells between tiles, so a single grid serves all members
+// without pairing particles of different members. The tiles are placed
+// anew every step around the members' current bounding boxes.
+// Members keep a fixed particle count: scene emitters and sinks are
+// ignored, and so are sleeping and adaptive levels, every particle is
+// stepped at the base resolution. Scenes with walls off or periodic axes
+// are refused.
+struct Ensemble
+{
+	SimParams params;
+	Kernel kernel;
+	up::Obstacles obstacles;	// shared by every member
+
+	// particle attributes, positions in member coordinates
+	std::vector<double> x, y;
+	std::vector<Real> vx, vy, fx, fy;
+	std::vector<float> rho, p;
+	std::vector<uint8_t> boundary;
+	std::vector<uint32_t> member;	// member owning each particle
+
+	std::vector<size_t> memberStart;	// first particle of each member, plus the total
+	std::vector<double> tileX, tileY;	// offset of each member on the neighbor grid
+	std::vector<double> tileWidth, tileHeight;	// bounding box of each member this step
+
+	NeighborGrid grid;
+
+	float dt = 0.01f;
+	uint64_t stepCount = 0;
+	double simTime = 0.0;
+
+	ThreadPool* pool = nullptr;
+
+	size_t size() const { return x.size(); }
+	size_t memberCount() const { return memberStart.empty() ? 0 : memberStart.size() - 1; }
+};
+
+// Fills the ensemble with members copies of the scene. Member k is laid out
+// by InitParticles with the scene seed plus k, so members differ only in
+// the jitter and member 0 matches a plain Simulation of the scene. Fails
+// for scenes without walls or with a periodic axis.
+bool SetupEnsemble(Ensemble& ensemble, const Scene& scene, size_t members, std::string& error);
+
+// One solver step of every member
+void StepEnsemble(Ensemble& ensemble);
+
+// Copies the particles of one member out, e.g. for output
+void ExportMember(const Ensemble& ensemble, size_t member, std::vector<Particle>& particles);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Simulation;
+
+// Thread partition of the density and force passes by measured cost. The
+// grid cells are ordered along a Morton (Z-order) curve over world space
+// and each thread of the pool takes one stretch of the curve. Every
+// params.balanceEvery steps the force pass times each cell, and the cuts
+// between stretches move so each holds an equal share of the measured time.
+// A cut whose stretch is within BALANCE_TOLERANCE of its share stays put,
+// and one that is off moves only to the edge of that window, so as few
+// cells as possible change threads.
+//
+// Between measurements the cuts stay fixed in space. Which thread handles
+// a particle does not change its result, so balanced runs are bit-identical
+// to unbalanced ones.
+struct CellPartition
+{
+	std::vector<uint64_t> cuts;			// parts - 1 curve keys, ascending
+	std::vector<uint64_t> previousCuts;	// before the last measurement
+	std::vector<uint32_t> cells;		// grid cells of this step grouped by part
+	std::vector<uint32_t> partStart;	// first entry of each part in cells, plus the end
+	std::vector<uint64_t> cellKey;		// curve key of each grid cell
+	std::vector<float> cellCost;		// seconds per grid cell, on measured steps
+	bool measuring = false;				// this step's force pass times the cells
+
+	uint64_t recuts = 0;				// measurements that moved a cut
+	uint64_t movedCells = 0;			// cells that changed threads in those
+
+	// 0 when the passes split by particle index instead
+	size_t parts() const { return partStart.empty() ? 0 : partStart.size() - 1; }
+};
+
+// Groups the cells of the freshly built grid by part, first cutting the
+// curve by particle counts when there are no cuts for this pool size yet.
+// Leaves no parts when params.balanceEvery is 0 or there is one thread.
+void AssignCells(Simulation& sim);
+
+// Moves the cuts by the cell costs of this step's force pass
+void RebalanceCells(Simulation& sim);
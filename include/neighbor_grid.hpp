@@ -0,0 +1,401 @@
+#pragma once
+
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+// Lengths of the periodic axes of a domain that starts at the origin, 0 for
+// open axes
+struct GridPeriod
+{
+	double x = 0.0, y = 0.0;
+
+	bool any() const { return x > 0.0 || y > 0.0; }
+
+	// Turns the offset d between two points inside the domain into the
+	// offset to the nearest image of the second one
+	template<class V>
+	void wrap(V& d) const
+	{
+		if (x > 0.0)
+		{
+			if (d(0) > 0.5 * x) d(0) -= x;
+			else if (d(0) < -0.5 * x) d(0) += x;
+		}
+		if (y > 0.0)
+		{
+			if (d(1) > 0.5 * y) d(1) -= y;
+			else if (d(1) < -0.5 * y) d(1) += y;
+		}
+	}
+};
+
+// Uniform grid over the bounding box of the particles, with cells as wide
+// as the kernel support. Particles are bucketed with a stable counting
+// sort, so every particle within the support of another lies in the 3x3
+// block of cells around it, and each cell lists its particles in index order.
+//
+// Along a periodic axis the grid spans the period instead, with cells a
+// little wider than the support so a whole number fits, and the blocks of
+// the first and last cells wrap around. No ghost copies are made: the
+// passes take distances through GridPeriod::wrap. A period should be at
+// least two supports long, or a particle meets only one image of another.
+//
+// When the bounding box holds many more cells than there are particles, as
+// in unbounded scenes where a few particles fly far off, only the occupied
+// cells are stored: they are found through a hash table, kept in row-major
+// order and given their neighbor ranges at build time. Memory then grows
+// with the particle count instead of the box, and the particles are
+// visited in the same order as with the full grid.
+class NeighborGrid
+{
+public:
+	// position(i) returns anything indexable as p(0), p(1)
+	template<class PositionOf>
+	void build(size_t count, float cellSize, PositionOf position, const GridPeriod& period = GridPeriod())
+	{
+		m_cellSize = cellSize;
+		m_period = period;
+
+		double minX = 0.0, minY = 0.0, maxX = 0.0, maxY = 0.0;
+		for (size_t i = 0; i < count; i++)
+		{
+			const auto& p = position(i);
+			if (i == 0 || p(0) < minX) minX = p(0);
+			if (i == 0 || p(1) < minY) minY = p(1);
+			if (i == 0 || p(0) > maxX) maxX = p(0);
+			if (i == 0 || p(1) > maxY) maxY = p(1);
+		}
+
+		setupAxis(period.x, minX, maxX, m_originX, m_invCellX, m_cols);
+		setupAxis(period.y, minY, maxY, m_originY, m_invCellY, m_rows);
+
+		m_sparse = double(m_cols) * m_rows > double(SPARSE_CELLS_PER_PARTICLE * count + SPARSE_MIN_CELLS);
+		if (m_sparse)
+		{
+			buildSparse(count, position);
+			return;
+		}
+
+		GrowCapacity(m_cellStart, static_cast<size_t>(m_cols) * m_rows + 1);
+		m_cellStart.assign(static_cast<size_t>(m_cols) * m_rows + 1, 0);
+		m_cell.resize(count);
+		m_sorted.resize(count);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			const auto& p = position(i);
+			uint32_t c = static_cast<uint32_t>(row(p(1)) * m_cols + column(p(0)));
+			m_cell[i] = c;
+			m_cellStart[c + 1]++;
+		}
+
+		scatter(count);
+	}
+
+	// Swaps the per-particle arrays for new ones with room for count
+	// particles, calling place(data, capacity) on each before anything is
+	// written to it, see FirstTouch. The grid is empty until the next build.
+	template<class Place>
+	void reserve(size_t count, Place place)
+	{
+		m_cellStart.clear();
+		for (std::vector<uint32_t>* array : { &m_cell, &m_sorted })
+		{
+			std::vector<uint32_t>().swap(*array);
+			array->reserve(count);
+			place(array->data(), array->capacity());
+		}
+	}
+
+	// Calls f(first, end) with runs of consecutive cells [first, end) that
+	// together cover the 3x3 block around cell c, top row first. A row
+	// splits in two where it wraps around a periodic axis; empty runs are
+	// skipped.
+	template<class F>
+	void forEachNeighborRange(uint32_t c, F f) const
+	{
+		if (m_sparse)
+		{
+			for (int k = 0; k < RANGES_PER_CELL; k++)
+			{
+				const CellRange& range = m_ranges[RANGES_PER_CELL * c + k];
+				if (range.first < range.end) f(range.first, range.end);
+			}
+			return;
+		}
+
+		forEachNeighborRun(c % m_cols, c / m_cols, [&](int y, int x0, int x1)
+		{
+			f(static_cast<uint32_t>(y * m_cols + x0), static_cast<uint32_t>(y * m_cols + x1 + 1));
+		});
+	}
+
+	// Calls f(j) for every particle in the 3x3 cells around particle i,
+	// including i itself. The three cells of a row are contiguous in the
+	// sorted list, so each row is one range.
+	template<class F>
+	void forEachNeighbor(size_t i, F f) const
+	{
+		int cx = m_cell[i] % m_cols;
+		int cy = m_cell[i] / m_cols;
+
+		// only blocks that wrap or are stored sparse need the general walk
+		if (m_sparse || (m_period.x > 0.0 && (cx == 0 || cx >= m_cols - 1 || m_cols <= 3)) || (m_period.y > 0.0 && (cy == 0 || cy >= m_rows - 1 || m_rows <= 3)))
+		{
+			forEachNeighborRange(m_cell[i], [&](uint32_t first, uint32_t end)
+			{
+				for (uint32_t k = m_cellStart[first]; k < m_cellStart[end]; k++) f(m_sorted[k]);
+			});
+			return;
+		}
+
+		int x0 = std::max(cx - 1, 0), x1 = std::min(cx + 1, m_cols - 1);
+		int y0 = std::max(cy - 1, 0), y1 = std::min(cy + 1, m_rows - 1);
+
+		for (int y = y0; y <= y1; y++)
+		{
+			uint32_t begin = m_cellStart[y * m_cols + x0];
+			uint32_t end = m_cellStart[y * m_cols + x1 + 1];
+			for (uint32_t k = begin; k < end; k++) f(m_sorted[k]);
+		}
+	}
+
+	// True when the block around particle i wraps around a periodic axis,
+	// so offsets to its neighbors need GridPeriod::wrap. Blocks inside
+	// the period never do: they span three cells of a period of five or more.
+	bool wraps(size_t i) const
+	{
+		if (!m_period.any()) return false;
+
+		int cx, cy;
+		cellCoords(m_cell[i], cx, cy);
+		return (m_period.x > 0.0 && (cx == 0 || cx >= m_cols - 1 || m_cols <= 4)) ||
+			(m_period.y > 0.0 && (cy == 0 || cy >= m_rows - 1 || m_rows <= 4));
+	}
+
+	float cellSize() const { return m_cellSize; }
+	bool sparse() const { return m_sparse; }
+	const GridPeriod& period() const { return m_period; }
+
+	// cells of the box, or only the occupied ones when sparse
+	size_t cellCount() const { return m_cellStart.empty() ? 0 : m_cellStart.size() - 1; }
+
+	uint32_t cellOf(size_t i) const { return m_cell[i]; }
+	const std::vector<uint32_t>& cellStart() const { return m_cellStart; }
+	const std::vector<uint32_t>& sorted() const { return m_sorted; }
+
+private:
+	// the box is stored whole up to this many cells per particle
+	const static size_t SPARSE_CELLS_PER_PARTICLE = 16;
+	const static size_t SPARSE_MIN_CELLS = 1 << 16;
+	const static int MAX_SPAN = (1 << 30) - 1;
+	const static uint64_t EMPTY_KEY = ~0ull;
+	const static int RANGES_PER_CELL = 6;	// three rows, each split at most once
+
+	struct CellRange
+	{
+		uint32_t first, end;
+	};
+
+	// An open axis covers [min, max] with cells of the support, spans past
+	// MAX_SPAN cells sharing the last one. A periodic axis covers the period.
+	void setupAxis(double period, double min, double max, double& origin, double& invCell, int& cells) const
+	{
+		if (period > 0.0)
+		{
+			cells = std::max(1, static_cast<int>(std::min(std::floor(period / m_cellSize), double(MAX_SPAN))));
+			origin = 0.0;
+			invCell = cells / period;
+		}
+		else
+		{
+			invCell = 1.0 / m_cellSize;
+			origin = min;
+			cells = static_cast<int>(std::min(std::floor((max - min) * invCell), double(MAX_SPAN))) + 1;
+		}
+	}
+
+	static int axisCell(double v, double origin, double invCell, int cells, bool periodic)
+	{
+		double c = std::floor((v - origin) * invCell);
+		if (periodic) c -= cells * std::floor(c / cells);
+		return static_cast<int>(std::min(std::max(c, 0.0), double(cells - 1)));
+	}
+
+	void cellCoords(uint32_t c, int& cx, int& cy) const
+	{
+		if (m_sparse)
+		{
+			uint64_t key = m_keys[m_order[c]];
+			cx = static_cast<int>(key & 0xffffffffull);
+			cy = static_cast<int>(key >> 32);
+		}
+		else
+		{
+			cx = c % m_cols;
+			cy = c / m_cols;
+		}
+	}
+
+	int column(double x) const { return axisCell(x, m_originX, m_invCellX, m_cols, m_period.x > 0.0); }
+	int row(double y) const { return axisCell(y, m_originY, m_invCellY, m_rows, m_period.y > 0.0); }
+
+	// Calls f(y, x0, x1) for each run of columns x0..x1 of a row of the
+	// 3x3 block around cell (cx, cy), each cell once even on periods of
+	// fewer than three cells
+	template<class F>
+	void forEachNeighborRun(int cx, int cy, F f) const
+	{
+		const bool wrapX = m_period.x > 0.0, wrapY = m_period.y > 0.0;
+
+		int y0 = cy - 1, y1 = cy + 1;
+		if (!wrapY) y0 = std::max(y0, 0), y1 = std::min(y1, m_rows - 1);
+		else if (m_rows <= 3) y0 = 0, y1 = m_rows - 1;
+
+		for (int y = y0; y <= y1; y++)
+		{
+			int wy = (y + m_rows) % m_rows;
+
+			if (!wrapX) f(wy, std::max(cx - 1, 0), std::min(cx + 1, m_cols - 1));
+			else if (m_cols <= 3) f(wy, 0, m_cols - 1);
+			else if (cx == 0)
+			{
+				f(wy, 0, 1);
+				f(wy, m_cols - 1, m_cols - 1);
+			}
+			else if (cx == m_cols - 1)
+			{
+				f(wy, cx - 1, cx);
+				f(wy, 0, 0);
+			}
+			else f(wy, cx - 1, cx + 1);
+		}
+	}
+
+	// row-major key of a cell, so sorted keys give the order of the full grid
+	uint64_t cellKey(double x, double y) const
+	{
+		return static_cast<uint64_t>(row(y)) << 32 | static_cast<uint64_t>(column(x));
+	}
+
+	// Occupied cell of key, or -1. Keys are hashed into m_slotKey, which is
+	// at least twice as large as the number of cells.
+	int64_t findCell(uint64_t key) const
+	{
+		size_t mask = m_slotKey.size() - 1;
+		for (size_t s = hashKey(key) & mask; m_slotKey[s] != EMPTY_KEY; s = (s + 1) & mask)
+			if (m_slotKey[s] == key) return m_slotCell[s];
+		return -1;
+	}
+
+	static size_t hashKey(uint64_t key)
+	{
+		key ^= key >> 31;
+		key *= 0x9e3779b97f4a7c15ull;
+		return static_cast<size_t>(key ^ key >> 29);
+	}
+
+	template<class PositionOf>
+	void buildSparse(size_t count, PositionOf position)
+	{
+		size_t slots = 16;
+		while (slots < 2 * count) slots *= 2;
+		m_slotKey.assign(slots, uint64_t(EMPTY_KEY));
+		m_slotCell.resize(slots);
+		m_keys.clear();
+		m_cell.resize(count);
+		m_sorted.resize(count);
+
+		// number the occupied cells in order of first appearance
+		for (size_t i = 0; i < count; i++)
+		{
+			const auto& p = position(i);
+			uint64_t key = cellKey(p(0), p(1));
+
+			size_t s = hashKey(key) & (slots - 1);
+			while (m_slotKey[s] != EMPTY_KEY && m_slotKey[s] != key) s = (s + 1) & (slots - 1);
+			if (m_slotKey[s] == EMPTY_KEY)
+			{
+				m_slotKey[s] = key;
+				m_slotCell[s] = static_cast<uint32_t>(m_keys.size());
+				m_keys.push_back(key);
+			}
+			m_cell[i] = m_slotCell[s];
+		}
+
+		// renumber them in key order
+		size_t cells = m_keys.size();
+		m_order.resize(cells);
+		for (size_t c = 0; c < cells; c++) m_order[c] = static_cast<uint32_t>(c);
+		std::sort(m_order.begin(), m_order.end(), [this](uint32_t a, uint32_t b) { return m_keys[a] < m_keys[b]; });
+
+		m_rank.resize(cells);
+		for (size_t r = 0; r < cells; r++) m_rank[m_order[r]] = static_cast<uint32_t>(r);
+		for (uint32_t& cell : m_slotCell) cell = m_rank[cell];
+
+		GrowCapacity(m_cellStart, cells + 1);
+		m_cellStart.assign(cells + 1, 0);
+		for (size_t i = 0; i < count; i++)
+		{
+			m_cell[i] = m_rank[m_cell[i]];
+			m_cellStart[m_cell[i] + 1]++;
+		}
+
+		// the occupied cells of a run of columns are consecutive
+		m_ranges.resize(RANGES_PER_CELL * cells);
+		for (size_t r = 0; r < cells; r++)
+		{
+			uint64_t key = m_keys[m_order[r]];
+			CellRange* range = &m_ranges[RANGES_PER_CELL * r];
+			for (int k = 0; k < RANGES_PER_CELL; k++) range[k].first = range[k].end = 0;
+
+			forEachNeighborRun(static_cast<int>(key & 0xffffffffull), static_cast<int>(key >> 32), [&](int y, int x0, int x1)
+			{
+				for (int x = x0; x <= x1; x++)
+				{
+					int64_t c = findCell(static_cast<uint64_t>(y) << 32 | static_cast<uint64_t>(x));
+					if (c < 0) continue;
+					if (range->first == range->end) range->first = static_cast<uint32_t>(c);
+					range->end = static_cast<uint32_t>(c) + 1;
+				}
+				range++;
+			});
+		}
+
+		scatter(count);
+	}
+
+	// prefix sums over the per-cell counts, then a stable scatter
+	void scatter(size_t count)
+	{
+		for (size_t c = 1; c < m_cellStart.size(); c++) m_cellStart[c] += m_cellStart[c - 1];
+
+		GrowCapacity(m_cursor, m_cellStart.size() - 1);
+		m_cursor.assign(m_cellStart.begin(), m_cellStart.end() - 1);
+		for (size_t i = 0; i < count; i++) m_sorted[m_cursor[m_cell[i]]++] = static_cast<uint32_t>(i);
+	}
+
+	float m_cellSize = 0.f;
+	GridPeriod m_period;
+	double m_invCellX = 0.0, m_invCellY = 0.0;
+	double m_originX = 0.0, m_originY = 0.0;
+	int m_cols = 0, m_rows = 0;		// of the bounding box or period, in cells
+	bool m_sparse = false;
+
+	std::vector<uint32_t> m_cellStart;	// first sorted slot of each cell, plus the end
+	std::vector<uint32_t> m_cell;		// cell of each particle
+	std::vector<uint32_t> m_sorted;		// particle indices ordered by cell
+	std::vector<uint32_t> m_cursor;
+
+	// sparse cells only
+	std::vector<uint64_t> m_slotKey;	// hash table from cell key...
+	std::vector<uint32_t> m_slotCell;	// ...to cell
+	std::vector<uint64_t> m_keys;		// cell keys in order of appearance
+	std::vector<uint32_t> m_order, m_rank;
+	std::vector<CellRange> m_ranges;	// RANGES_PER_CELL neighbor runs per cell
+};
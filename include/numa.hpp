@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+struct Simulation;
+
+// Memory placement and thread pinning for machines with several NUMA nodes
+// (sockets). Linux places a page on the node of the thread that first
+// writes it, so arrays filled by one thread all end up on its node and the
+// other node's cores read them remotely. With first touch, the particle
+// store and the per-particle grid arrays are moved into fresh pages that
+// each pool thread writes first over the index range it handles in the
+// passes split by index. Pinning keeps the threads on the nodes their
+// pages went to, spreading the pool's contiguous chunks over the nodes in
+// order. The passes split by cell cost (load_balance.hpp) still read
+// across the ranges.
+//
+// Both are on by default only when the machine has more than one node.
+
+enum class NumaMode
+{
+	Auto,	// on with more than one NUMA node
+	On,
+	Off
+};
+
+// CPUs of each NUMA node this process may run on, read from sysfs once.
+// One node with every allowed CPU when the topology is unknown.
+const std::vector<std::vector<int>>& NumaNodes();
+
+bool NumaEnabled(NumaMode mode);
+
+// CPU for pool thread index of threads: thread chunks follow each other
+// across the nodes, and within a node across its CPUs
+int PinnedCpu(unsigned index, unsigned threads);
+
+// Pins the calling thread to cpu, false if the system refuses
+bool PinCurrentThread(int cpu);
+
+// Writes one byte per page of an array of capacity elements of elementSize
+// bytes that nothing has written yet, each page from the pool thread whose
+// ParallelFor range over the first count elements covers it. The pages past
+// count are split evenly too.
+void FirstTouch(ThreadPool* pool, void* data, size_t elementSize, size_t count, size_t capacity);
+
+// Moves the particles and the grid's per-particle arrays into first-touched
+// pages, keeping the capacity of the store. Call after setting sim.pool
+// and after anything that reallocates the store, like a restore.
+void PlaceParticles(Simulation& sim);
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "vec2.hpp"
+
+#include <vector>
+
+namespace up
+{
+
+struct AABB
+{
+	AABB() noexcept :
+		min(1e30f, 1e30f),
+		max(-1e30f, -1e30f)
+	{}
+
+	void grow(const Vec2& p)
+	{
+		if (p.x < min.x) min.x = p.x;
+		if (p.y < min.y) min.y = p.y;
+		if (p.x > max.x) max.x = p.x;
+		if (p.y > max.y) max.y = p.y;
+	}
+
+	void grow(const AABB& b)
+	{
+		grow(b.min);
+		grow(b.max);
+	}
+
+	// Squared distance from a point to the box, 0 when inside
+	float distance2(const Vec2& p) const
+	{
+		float dx = p.x < min.x ? min.x - p.x : (p.x > max.x ? p.x - max.x : 0.0f);
+		float dy = p.y < min.y ? min.y - p.y : (p.y > max.y ? p.y - max.y : 0.0f);
+		return dx*dx + dy*dy;
+	}
+
+	Vec2 min, max;
+};
+
+// Closest wall to a point
+struct WallContact
+{
+	float distance;
+	Vec2 point;
+	Vec2 normal;	// unit vector from the wall towards the query point
+	int segment;
+};
+
+// First wall crossed by a moving point
+struct WallHit
+{
+	float t;		// fraction of the motion at the time of impact
+	Vec2 point;
+	Vec2 normal;	// unit wall normal facing the incoming point
+	int segment;
+};
+
+// Bounding volume hierarchy over wall segments. Both queries descend
+// only into boxes that can still improve the current best answer, so they
+// cost O(log S) for S segments instead of a scan of every wall.
+class SegmentBVH
+{
+public:
+	void build(const std::vector<Segment>& segments);
+
+	bool empty() const { return m_nodes.empty(); }
+	const std::vector<Segment>& segments() const { return m_segments; }
+
+	bool closest(const Vec2& p, float maxDistance, WallContact& contact) const;
+	bool sweep(const Vec2& from, const Vec2& to, WallHit& hit) const;
+
+private:
+	struct Node
+	{
+		AABB box;
+		int first;	// first segment for leaves, left child otherwise
+		int count;	// number of segments, 0 for inner nodes
+	};
+
+	void buildNode(int index, int first, int count);
+
+	std::vector<Node> m_nodes;
+	std::vector<Segment> m_segments;
+};
+
+struct Polygon
+{
+	std::vector<Vec2> points;
+	bool closed = true;
+};
+
+struct Obstacles
+{
+	std::vector<Polygon> polygons;
+	SegmentBVH bvh;
+
+	bool empty() const { return bvh.empty(); }
+	void rebuild();
+};
+
+}
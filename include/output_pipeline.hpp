@@ -0,0 +1,74 @@
+#pragma once
+
+#include "snapshot.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// What to do when the writer thread falls behind and no buffer is free
+enum class BackpressurePolicy
+{
+	Block,		// wait for the writer, the simulation slows down to disk speed
+	Drop,		// skip the frame
+	Decimate	// keep only every n-th frame, n doubles on overflow and halves once the queue drains
+};
+
+// Bits of OutputFrame::targets
+const static uint32_t OUTPUT_CSV = 1;		// one text row for the first particle
+const static uint32_t OUTPUT_SNAPSHOT = 2;	// the whole field as a binary frame
+
+struct OutputFrame
+{
+	SnapshotFrame data;
+	uint32_t targets = 0;
+};
+
+// Hands frames from the solver to a writer thread through a bounded queue.
+// Frame buffers are owned by a fixed pool and recycled once written, so
+// after warm-up no step allocates and no step waits on the disk unless the
+// policy is Block.
+class OutputPipeline
+{
+public:
+	typedef std::function<void(const OutputFrame&)> Sink;
+
+	~OutputPipeline();
+
+	void start(const Sink& sink, size_t buffers, BackpressurePolicy policy);
+	void stop();	// writes out everything queued, then joins the writer
+
+	bool running() const { return m_thread.joinable(); }
+
+	// Returns a free buffer, or nullptr when the policy skips this frame
+	OutputFrame* acquire();
+	void submit(OutputFrame* frame);
+
+	uint64_t written() const { return m_written; }
+	uint64_t dropped() const { return m_dropped; }
+
+private:
+	void run();
+
+	Sink m_sink;
+	BackpressurePolicy m_policy = BackpressurePolicy::Block;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_queued, m_freed;
+
+	std::vector<std::unique_ptr<OutputFrame>> m_storage;
+	std::vector<OutputFrame*> m_pool;
+
+	// ring of submitted frames, never larger than the pool
+	std::vector<OutputFrame*> m_queue;
+	size_t m_head = 0, m_count = 0;
+
+	bool m_stop = false;
+	unsigned m_decimation = 1;
+	uint64_t m_offered = 0, m_written = 0, m_dropped = 0;
+};
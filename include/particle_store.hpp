@@ -0,0 +1,25 @@
+#pragma once
+
+#include "sph.hpp"
+
+// Particle creation and removal while the simulation runs. Removed
+// particles leave holes in Simulation::particles that later spawns reuse
+// first. The holes still open when the neighbor grid is rebuilt are closed
+// in one pass by moving particles from the end, so the vector only ever
+// shrinks in place and, within the reserved capacity, never reallocates.
+
+// Reserves room for sim.maxParticles, or the current count if larger
+void ReserveParticles(Simulation& sim);
+
+// Stores p in a free slot, or at the end. Returns false at maxParticles.
+bool SpawnParticle(Simulation& sim, const Particle& p);
+
+// Frees the slot of particle i, which must not be used until it is respawned
+// or compacted away
+void RemoveParticle(Simulation& sim, size_t i);
+
+// Closes all holes. Particles move, so indices are not stable across it.
+void CompactParticles(Simulation& sim);
+
+// Runs the sinks, then the emitters, for one step of sim.dt
+void ApplyEmittersAndSinks(Simulation& sim);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Optional hardware performance counters (Linux perf_event_open). Each
+// thread that enables them opens its own counters, and reads return the
+// sum over all such threads, so a phase whose work is spread over a thread
+// pool is counted whole. Containers and VMs often hide some or all of
+// them, so every counter is optional and missing ones simply read as zero.
+
+class ThreadPool;
+
+enum PerfCounter
+{
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_COUNTER_COUNT
+};
+
+const char* PerfCounterName(PerfCounter counter);
+
+struct PerfCounts
+{
+	uint64_t values[PERF_COUNTER_COUNT];
+};
+
+// Opens the counters for the calling thread and, with a pool, for each of
+// its workers. Returns false with a reason when none are available.
+bool EnablePerfCounters(std::string& error, ThreadPool* pool = nullptr);
+bool PerfCountersEnabled();
+bool PerfCounterAvailable(PerfCounter counter);
+unsigned PerfCounterThreads();	// threads whose counters reads sum up
+
+// Cumulative counts summed over every thread that enabled counters, each
+// scaled for multiplexing
+void ReadPerfCounters(PerfCounts& counts);
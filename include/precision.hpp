@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+// Build-time precision policy, set through CMake:
+//
+//   FLUIDSIM_FLOAT_STORAGE       velocities and forces stored as float.
+//                                Positions always stay double, so large
+//                                domains keep their resolution; pair
+//                                offsets are taken in double and then
+//                                narrowed.
+//   FLUIDSIM_ACCUMULATE_DOUBLE   density and force sums carried in double
+//   FLUIDSIM_ACCUMULATE_KAHAN    density and force sums compensated in the
+//                                storage precision
+//
+// Without any of them the solver keeps its original types.
+
+#ifdef FLUIDSIM_FLOAT_STORAGE
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
+typedef Eigen::Matrix<Real, 2, 1> Vector2r;
+
+#if defined(FLUIDSIM_ACCUMULATE_DOUBLE) && defined(FLUIDSIM_ACCUMULATE_KAHAN)
+#error "FLUIDSIM_ACCUMULATE_DOUBLE and FLUIDSIM_ACCUMULATE_KAHAN are exclusive"
+#endif
+
+#ifdef FLUIDSIM_ACCUMULATE_DOUBLE
+typedef double DensityAccum;
+typedef double ForceAccum;
+#else
+typedef float DensityAccum;
+typedef Real ForceAccum;
+#endif
+
+// Neighbor sum of density contributions
+class DensitySum
+{
+public:
+	void add(float x)
+	{
+#ifdef FLUIDSIM_ACCUMULATE_KAHAN
+		DensityAccum y = x - m_c;
+		DensityAccum t = m_sum + y;
+		m_c = (t - m_sum) - y;
+		m_sum = t;
+#else
+		m_sum += x;
+#endif
+	}
+
+	float value() const { return static_cast<float>(m_sum); }
+
+private:
+	DensityAccum m_sum = 0;
+#ifdef FLUIDSIM_ACCUMULATE_KAHAN
+	DensityAccum m_c = 0;
+#endif
+};
+
+// Neighbor sum of force contributions
+class ForceSum
+{
+public:
+	typedef Eigen::Matrix<ForceAccum, 2, 1> Vector;
+
+	void add(const Vector2r& x)
+	{
+#ifdef FLUIDSIM_ACCUMULATE_KAHAN
+		Vector y = x.cast<ForceAccum>() - m_c;
+		Vector t = m_sum + y;
+		m_c = (t - m_sum) - y;
+		m_sum = t;
+#else
+		m_sum += x.cast<ForceAccum>();
+#endif
+	}
+
+	Vector2r value() const { return m_sum.cast<Real>(); }
+
+private:
+	Vector m_sum = Vector::Zero();
+#ifdef FLUIDSIM_ACCUMULATE_KAHAN
+	Vector m_c = Vector::Zero();
+#endif
+};
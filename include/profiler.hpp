@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include "perf_counters.hpp"
+#include "trace.hpp"
+
+enum ProfilePhase
+{
+	PHASE_NEIGHBORS,
+	PHASE_DENSITY,
+	PHASE_FORCES,
+	PHASE_INTEGRATION,
+	PHASE_OUTPUT,
+	PHASE_RENDER,
+	PHASE_COUNT
+};
+
+const char* PhaseName(ProfilePhase phase);
+
+struct PhaseStats
+{
+	uint64_t samples;	// samples in the rolling window
+	double minMs, avgMs, p99Ms;
+};
+
+// Recent durations of one phase. Any number of threads may append at once,
+// as fluidsim_sweep does with one simulation per job, without locking.
+// Readers copy the window and may see a slot just claimed but not yet
+// written, or being overwritten, which only blurs the statistics.
+class PhaseRing
+{
+public:
+	static const size_t CAPACITY = 256;
+
+	void push(float ms);
+	PhaseStats stats() const;
+
+	uint64_t total() const { return m_count.load(std::memory_order_acquire); }
+	double totalMs() const { return m_totalMs.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<float> m_samples[CAPACITY] = {};
+	std::atomic<uint64_t> m_count{0};
+	std::atomic<double> m_totalMs{0.0};
+};
+
+void RecordPhase(ProfilePhase phase, float ms);
+void RecordPhaseCounters(ProfilePhase phase, const PerfCounts& start, const PerfCounts& end);
+PhaseStats GetPhaseStats(ProfilePhase phase);
+
+// Prints the rolling window and whole-run averages of every phase
+void DumpProfile(std::ostream& out);
+
+// Times the enclosing scope into a phase, and into the trace and the
+// hardware counters of the phase when those are enabled
+class ScopedTimer
+{
+public:
+	explicit ScopedTimer(ProfilePhase phase) :
+		m_phase(phase),
+		m_trace(PhaseName(phase)),
+		m_counters(PerfCountersEnabled())
+	{
+		if (m_counters) ReadPerfCounters(m_startCounts);
+		m_start = std::chrono::steady_clock::now();
+	}
+
+	~ScopedTimer()
+	{
+		std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - m_start;
+		if (m_counters)
+		{
+			PerfCounts end;
+			ReadPerfCounters(end);
+			RecordPhaseCounters(m_phase, m_startCounts, end);
+		}
+		RecordPhase(m_phase, elapsed.count());
+	}
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+	ProfilePhase m_phase;
+	TraceScope m_trace;
+	bool m_counters;
+	PerfCounts m_startCounts;
+	std::chrono::steady_clock::time_point m_start;
+};
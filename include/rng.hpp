@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+// splitmix64 output function
+inline uint64_t Mix64(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+const static uint64_t DEFAULT_SEED = 0x853c49e6748fea9bull;
+
+// splitmix64. The whole generator is one 64-bit word, so it can be saved
+// in a checkpoint and restored to continue the exact same sequence.
+struct Rng
+{
+	explicit Rng(uint64_t seed = DEFAULT_SEED) noexcept :
+		state(seed)
+	{}
+
+	uint64_t next()
+	{
+		return Mix64(state += 0x9e3779b97f4a7c15ull);
+	}
+
+	// uniform in [0, 1)
+	float uniform()
+	{
+		return static_cast<float>(next() >> 40) * (1.0f / 16777216.0f);
+	}
+
+	uint64_t state;
+};
+
+// Counter-based splitmix64: draw k depends only on the seed and k, not on
+// how many draws came before or on which thread asks. at(k) is the
+// (k+1)-th next() of Rng(seed).
+struct CounterRng
+{
+	explicit CounterRng(uint64_t seed = DEFAULT_SEED) noexcept :
+		seed(seed)
+	{}
+
+	uint64_t at(uint64_t counter) const
+	{
+		return Mix64(seed + (counter + 1) * 0x9e3779b97f4a7c15ull);
+	}
+
+	// uniform in [0, 1)
+	float uniform(uint64_t counter) const
+	{
+		return static_cast<float>(at(counter) >> 40) * (1.0f / 16777216.0f);
+	}
+
+	uint64_t seed;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "numa.hpp"
+#include "obstacles.hpp"
+#include "output_pipeline.hpp"
+#include "sim_params.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Simulation;
+
+// Everything an experiment varies: physical constants, particle layout,
+// obstacles, output cadence and thread count. A default Scene is the
+// original hard-coded dam break.
+struct Scene
+{
+	Scene();
+
+	SimParams params;
+	std::vector<ParticleBlock> fluid;
+	std::vector<ParticleBlock> boundary;
+	std::vector<up::Polygon> obstacles;
+	std::vector<Emitter> emitters;
+	std::vector<Sink> sinks;
+	size_t maxParticles = 10000;	// store capacity, emitters stop there
+
+	uint64_t outputEvery = 1;		// log every n-th step
+	size_t outputBuffers = 8;		// output frames in flight
+	BackpressurePolicy outputPolicy = BackpressurePolicy::Block;
+	uint64_t checkpointEvery = 0;	// 0 saves only on demand
+
+	unsigned threads = 1;			// 0 uses every hardware thread
+	NumaMode firstTouch = NumaMode::Auto;	// place the particle pages per thread
+	NumaMode pinThreads = NumaMode::Auto;	// pin the pool threads to CPUs
+};
+
+// Scene files hold one "key value" setting per line, with the same keys
+// as SetSceneValue, plus obstacle outlines:
+//
+//   # comment
+//   visc 2.5
+//   gravity 0 -9.8
+//   fluid x0 y0 x1 y1 [max-count]
+//   emitter x0 y0 x1 y1 vx vy rate
+//   sink x0 y0 x1 y1
+//   polygon closed|open
+//   x y
+//   ...
+//   end
+//
+// The first fluid or boundary line of a file replaces the default blocks.
+// scene is only changed when the whole file loads; Missing means the file
+// could not be opened, Invalid that it holds a bad line.
+enum class SceneLoad
+{
+	Loaded,
+	Missing,
+	Invalid
+};
+
+SceneLoad LoadScene(const std::string& path, Scene& scene, std::string& error);
+
+// Applies one setting, e.g. ("visc", "2.5") or ("gravity", "0 -9.8").
+// fluid and boundary add a block.
+bool SetSceneValue(Scene& scene, const std::string& key, const std::string& value, std::string& error);
+
+// Parses "key=value" as given on the command line
+bool SetSceneOverride(Scene& scene, const std::string& assignment, std::string& error);
+
+// Resets sim to the start of the scene: constants, obstacles and particles.
+// Leaves the thread pool alone.
+void SetupSimulation(Simulation& sim, const Scene& scene);
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rng.hpp"
+
+// Pressure from density
+enum class EquationOfState
+{
+	Linear,		// p = k (rho/rho0 - 1)
+	Tait		// p = k/7 ((rho/rho0)^7 - 1), same slope at rest but much stiffer under compression
+};
+
+// Physical constants and domain of one simulation. The defaults are the
+// original compile-time values.
+struct SimParams
+{
+	float h = 16.f;				// Kernel support 
+	float eps = 0.f; 			// Boundary epsilon, 0 follows H
+	float mass = 45.f;			
+	float visc = 5.f;			// 5
+
+	float restDens = 0.176f;		 // rest density 0.1f
+	float stiffness = 2.f;		 // const for equation of state 2
+	EquationOfState eos = EquationOfState::Linear;
+
+	Eigen::Vector2d gravity = Eigen::Vector2d(0.f, -9.8f); // gravity forces
+	float dt = 0.01f;			 // integration timestep
+	float boundDamping = -0.5f;
+
+	// Sleeping: a fluid particle is quiet while slower than sleepSpeed and
+	// its density changes by less than sleepDensity*restDens per step. Cells
+	// whose 3x3 block has been quiet for sleepSteps steps are skipped. The
+	// window must be longer than a particle at rest needs to pass
+	// sleepSpeed under gravity, or a column about to fall sleeps at once.
+	float sleepSpeed = 0.f;			// 0 disables sleeping
+	float sleepDensity = 1e-3f;
+	uint16_t sleepSteps = 100;
+
+	// Adaptive resolution: fluid particles near the free surface or a wall
+	// split in two, each with half the mass and the smoothing length over
+	// sqrt(2), down to adaptLevels levels below the base. Pairs of split
+	// particles deep in the bulk merge again. Finer levels may need a
+	// smaller dt.
+	unsigned adaptLevels = 0;		// 0 disables adaptivity
+	unsigned adaptEvery = 10;		// steps between refinement passes
+	float splitDensity = 0.85f;		// split below this fraction of restDens...
+	float mergeDensity = 0.98f;		// ...merge above this one
+	float splitDistance = 16.f;		// split this close to a wall, merge beyond twice it
+
+	// Thread partition of the density and force passes, see load_balance.hpp
+	unsigned balanceEvery = 200;	// steps between measured recuts, 0 splits by particle index
+
+	// simulation domain, also the rendering projection
+	double viewWidth = 800.f;
+	double viewHeight = 600.f;
+	bool walls = true;		// off leaves the domain open on all sides, see NeighborGrid
+	bool periodicX = false;	// wrap around instead of the walls along an axis
+	bool periodicY = false;
+
+	uint64_t seed = DEFAULT_SEED;	// jitter of the initial layout
+	bool deterministic = false;		// reproducible layout, see InitParticles
+
+	float boundaryEps() const { return eps > 0.f ? eps : h; }
+};
+
+// Cubic spline constants derived once from H, so the kernels do not
+// recompute them per pair
+struct Kernel
+{
+	Kernel() : Kernel(SimParams().h) {}
+
+	explicit Kernel(float h) :
+		h(h),
+		support(2*h),
+		alpha(static_cast<float>(5/(14*M_PI*pow(h, 2))))
+	{}
+
+	float h;
+	float support;
+	float alpha;
+};
+
+// Finest resolution level below the base particles
+const static unsigned MAX_ADAPT_LEVELS = 4;
+
+// Rectangle filled row by row with particles, at most maxCount of them
+struct ParticleBlock
+{
+	float x0, y0, x1, y1;
+	size_t maxCount;
+};
+
+// Spawns up to rate fluid particles per second, all moving with the given
+// velocity, on the free points of a lattice of spacing H over its rectangle
+struct Emitter
+{
+	float x0, y0, x1, y1;
+	Eigen::Vector2d velocity;
+	float rate;
+
+	// running state
+	uint64_t emitted = 0;
+	uint64_t cursor = 0;			// next lattice point to try
+	double pending = 0.0;			// fraction of a particle carried to the next step
+	std::vector<uint8_t> occupied;	// lattice points with fluid nearby
+};
+
+// Removes every fluid particle that enters its rectangle
+struct Sink
+{
+	float x0, y0, x1, y1;
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Binary whole-field snapshots, little-endian, version 1:
+//
+//   SnapshotHeader
+//   SnapshotAttribute[attributeCount]
+//   frames: SnapshotFrameHeader followed by one block per attribute
+//           (SoA, in table order, each block padded to 8 bytes)
+//   SnapshotIndexEntry[frameCount] at indexOffset
+//
+// The header is rewritten on close with the frame count and the index
+// offset. A file whose writer died has indexOffset 0; the reader then
+// recovers the index by walking the frames.
+
+const static uint32_t SNAPSHOT_VERSION = 1;
+
+enum SnapshotType : uint32_t
+{
+	SNAPSHOT_FLOAT32 = 1,
+	SNAPSHOT_UINT8 = 2
+};
+
+// Attribute blocks of every frame, in file order
+enum SnapshotAttributeId
+{
+	SNAP_X, SNAP_Y, SNAP_VX, SNAP_VY, SNAP_RHO, SNAP_P, SNAP_FLAGS,
+	SNAP_ATTRIBUTE_COUNT
+};
+
+const static uint8_t SNAP_FLAG_BOUNDARY = 1;
+
+#pragma pack(push, 1)
+struct SnapshotHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t attributeCount;
+	uint32_t reserved;
+	uint64_t frameCount;
+	uint64_t indexOffset;
+};
+
+struct SnapshotAttribute
+{
+	char name[16];
+	uint32_t type;
+	uint32_t components;
+};
+
+struct SnapshotFrameHeader
+{
+	uint64_t step;
+	double time;
+	uint64_t particleCount;
+	uint64_t tag;		// SNAPSHOT_FRAME_TAG, lets recovery find frame boundaries
+};
+
+struct SnapshotIndexEntry
+{
+	uint64_t offset;
+	uint64_t step;
+	double time;
+	uint64_t particleCount;
+};
+#pragma pack(pop)
+
+// One frame of particle state in SoA layout, as handed to the writer
+struct SnapshotFrame
+{
+	uint64_t step = 0;
+	double time = 0.0;
+	std::vector<float> x, y, vx, vy, rho, p;
+	std::vector<uint8_t> flags;
+
+	size_t size() const { return x.size(); }
+	void resize(size_t n);
+};
+
+class TextWriter;
+
+// Writes the frame as CSV, one row per particle under a header of the
+// attribute names, with the writer's precision
+void WriteFrameCsv(TextWriter& out, const SnapshotFrame& frame);
+
+class SnapshotWriter
+{
+public:
+	~SnapshotWriter();
+
+	bool open(const std::string& path);
+	bool isOpen() const { return m_file.is_open(); }
+	bool write(const SnapshotFrame& frame);
+	void close();
+
+	size_t frameCount() const { return m_index.size(); }
+
+private:
+	void writeHeader(uint64_t indexOffset);
+
+	std::ofstream m_file;
+	std::vector<SnapshotIndexEntry> m_index;
+	uint64_t m_offset = 0;
+};
+
+// Read-only view of one frame, pointing into the mapped file
+struct SnapshotView
+{
+	uint64_t step;
+	double time;
+	size_t count;
+	const float *x, *y, *vx, *vy, *rho, *p;
+	const uint8_t* flags;
+};
+
+class SnapshotReader
+{
+public:
+	SnapshotReader() = default;
+	~SnapshotReader();
+
+	// owns the mapping, so copies would unmap it twice
+	SnapshotReader(const SnapshotReader&) = delete;
+	SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+	bool open(const std::string& path, std::string& error);
+	void close();
+
+	size_t frameCount() const { return m_index.size(); }
+	const SnapshotIndexEntry& entry(size_t i) const { return m_index[i]; }
+	SnapshotView frame(size_t i) const;
+
+private:
+	bool recoverIndex(std::string& error);
+
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+	std::vector<SnapshotIndexEntry> m_index;
+};
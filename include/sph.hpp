@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Eigen/Dense>
+
+#include <cstdint>
+#include <vector>
+
+#include "arena.hpp"
+#include "load_balance.hpp"
+#include "neighbor_grid.hpp"
+#include "obstacles.hpp"
+#include "precision.hpp"
+#include "rng.hpp"
+#include "sim_params.hpp"
+#include "thread_pool.hpp"
+
+const static int MAX_CCD_BOUNCES = 4;
+
+struct Particle
+{
+	Particle(float _x, float _y, float _rho, bool _isBoundary) : x(_x, _y), v(0.f, 0.f), f(0.f, 0.f), rho(_rho), p(0.f), isBoundary(_isBoundary), level(0), quietSteps(0) {}
+	Eigen::Vector2d x;	// always double, see precision.hpp
+	Vector2r v, f;
+	float rho, p;
+	bool isBoundary;
+	uint8_t level;			// resolution level, 0 for base particles, see adaptive.hpp
+	uint16_t quietSteps;	// steps below the sleep thresholds, saturating
+};
+
+// Everything one running simulation owns
+struct Simulation
+{
+	Simulation();	// with the default parameters, see SetParams
+
+	SimParams params;
+	Kernel kernel;
+
+	// per resolution level, and the kernel of each pair of levels with
+	// the mean smoothing length, levels*levels of them
+	std::vector<float> levelMass, levelH;
+	std::vector<Kernel> pairKernels;
+
+	std::vector<Particle> particles;
+	std::vector<uint32_t> freeSlots;	// removed particles, see particle_store.hpp
+	size_t haloCount = 0;				// read-only copies at the end, see distributed.hpp
+	size_t maxParticles = 0;			// capacity kept for emitters, 0 for no limit
+	std::vector<Emitter> emitters;
+	std::vector<Sink> sinks;
+
+	NeighborGrid grid;
+	std::vector<uint8_t> cellQuiet;		// per grid cell, see UpdateSleep
+	std::vector<uint8_t> cellAsleep;
+	size_t sleepingCount = 0;			// fluid particles skipped this step
+	std::vector<uint8_t> adaptAction;	// per particle, see AdaptResolution
+	CellPartition partition;			// of the grid cells among the threads
+	Arena scratch;						// per-step buffers, freed as each step ends
+
+	up::Obstacles obstacles;	// polygonal obstacles loaded from the scene file
+	Rng rng;
+
+	float dt = 0.01f;			// integration timestep
+	uint64_t stepCount = 0;
+	double simTime = 0.0;
+
+	ThreadPool* pool = nullptr;	// runs the passes in parallel when set
+};
+
+// Particles the passes advance: all but the halo copies at the end
+inline size_t OwnedCount(const Simulation& sim) { return sim.particles.size() - sim.haloCount; }
+
+// Sets the constants, the timestep and the derived kernel constants of
+// every resolution level
+void SetParams(Simulation& sim, const SimParams& params);
+
+// Fills the blocks row by row at spacing H, fluid particles with up to one
+// unit of jitter. In deterministic mode the jitter of a particle depends
+// only on the seed and its index, so restarts and reordered setups give
+// the same layout; otherwise it continues the simulation's Rng.
+void InitParticles(Simulation& sim, const std::vector<ParticleBlock>& fluid, const std::vector<ParticleBlock>& boundary);
+
+// Periodic axes of the domain, which starts at the origin
+GridPeriod DomainPeriod(const SimParams& params);
+
+float KernelFunction(const Kernel& kernel, float distance);
+Vector2r KernelFirstDerivativeFunction(const Kernel& kernel, Vector2r normalizedDistance, float distance);
+
+// Constants of the integration pass, derived once per step
+struct IntegrationConstants
+{
+	IntegrationConstants(const SimParams& params, float dt);
+
+	float dt;
+	float eps;			// closest a particle may get to the domain walls
+	float damping;
+	float obstacleEps;	// closest a particle may get to an obstacle wall
+	float ccdSkin;		// offset off a wall after a swept collision
+	double width, height;
+	bool walls;			// confine to the domain
+	GridPeriod period;	// wrap around these axes instead
+};
+
+// Advances one fluid particle by dt and resolves its collisions with the
+// domain walls and the obstacles
+void IntegrateParticle(const IntegrationConstants& constants, const up::Obstacles& obstacles, Particle& p);
+
+void NeighborSearch(Simulation& sim);
+
+// Marks the grid cells whose particles skip density, forces and
+// integration this step. A cell sleeps when every fluid particle in its
+// 3x3 block has been quiet for params.sleepSteps steps, so any moving
+// particle nearby wakes it again. No-op unless params.sleepSpeed > 0.
+void UpdateSleep(Simulation& sim);
+void CalculateDensityPressure(Simulation& sim);
+void CalculateForces(Simulation& sim);
+void UpdatePositionVelocity(Simulation& sim);
+
+// One solver step: emitters and sinks, neighbors, density and pressure,
+// forces, integration, then splitting and merging. Scratch buffers of the
+// passes come from sim.scratch for the duration of the step.
+void Step(Simulation& sim);
+
+// Whole-fluid statistics, reduced in a fixed order so they do not depend
+// on the thread count
+struct SimDiagnostics
+{
+	size_t fluidCount = 0;
+	double kineticEnergy = 0.0;
+	double meanDensity = 0.0;
+	double maxDensity = 0.0;
+	double maxSpeed = 0.0;
+	bool finite = true;		// no NaN or infinity in the fluid state
+};
+
+SimDiagnostics Diagnose(const Simulation& sim);
+
+// FNV-1a over the positions, velocities, densities and pressures of all
+// owned particles in order. Equal hashes mean bitwise equal states, e.g. of a
+// reference run and an optimized build.
+uint64_t StateHash(const Simulation& sim);
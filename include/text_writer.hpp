@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Formatters that write into out and return the end of the text. They take
+// no locale and allocate nothing; out must hold FORMAT_MAX chars.
+const static size_t FORMAT_MAX = 328;		// a fixed double of 1e308 with 9 decimals
+const static int FORMAT_MAX_DECIMALS = 9;
+
+char* FormatUnsigned(char* out, uint64_t value);
+char* FormatInteger(char* out, int64_t value);
+
+// value as 16 lowercase hex digits, leading zeros included, for hashes
+char* FormatHex(char* out, uint64_t value);
+
+// value with decimals places (clamped to [0, FORMAT_MAX_DECIMALS]), the
+// same digits printf("%.*f") writes except that negative zero prints as 0
+char* FormatFixed(char* out, double value, int decimals);
+
+// value with digits significant digits, the same text printf("%.*g") and
+// ostream's default notation write
+char* FormatSignificant(char* out, double value, int digits);
+
+// A double written with the given number of decimals
+struct Fixed
+{
+	Fixed(double value, int decimals) : value(value), decimals(decimals) {}
+
+	double value;
+	int decimals;
+};
+
+// A double written with the given number of significant digits
+struct Significant
+{
+	Significant(double value, int digits) : value(value), digits(digits) {}
+
+	double value;
+	int digits;
+};
+
+// A 64-bit value written as 16 hex digits
+struct Hex
+{
+	explicit Hex(uint64_t value) : value(value) {}
+
+	uint64_t value;
+};
+
+// Buffered text output for CSV and diagnostics. Numbers are formatted
+// straight into one buffer, which goes to the stream in large writes, so
+// dumping whole frames runs at disk speed rather than ostream speed.
+// Plain doubles get precision() decimals. Flushes on destruction.
+class TextWriter
+{
+public:
+	explicit TextWriter(std::ostream& out, size_t bufferSize = 1 << 16);
+	~TextWriter();
+
+	TextWriter(const TextWriter&) = delete;
+	TextWriter& operator=(const TextWriter&) = delete;
+
+	void flush();
+
+	void precision(int decimals) { m_decimals = decimals; }
+	int precision() const { return m_decimals; }
+
+	TextWriter& operator<<(char c)
+	{
+		if (m_used == m_buffer.size()) flush();
+		m_buffer[m_used++] = c;
+		return *this;
+	}
+
+	TextWriter& operator<<(const char* text);
+	TextWriter& operator<<(const std::string& text);
+
+	template<class T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+	TextWriter& operator<<(T value)
+	{
+		char* out = reserve();
+		m_used = (std::is_signed<T>::value ? FormatInteger(out, static_cast<int64_t>(value))
+			: FormatUnsigned(out, static_cast<uint64_t>(value))) - m_buffer.data();
+		return *this;
+	}
+
+	TextWriter& operator<<(double value) { return *this << Fixed(value, m_decimals); }
+
+	TextWriter& operator<<(const Fixed& value)
+	{
+		m_used = FormatFixed(reserve(), value.value, value.decimals) - m_buffer.data();
+		return *this;
+	}
+
+	TextWriter& operator<<(const Significant& value)
+	{
+		m_used = FormatSignificant(reserve(), value.value, value.digits) - m_buffer.data();
+		return *this;
+	}
+
+	TextWriter& operator<<(const Hex& value)
+	{
+		m_used = FormatHex(reserve(), value.value) - m_buffer.data();
+		return *this;
+	}
+
+private:
+	// Room for one formatted number at the end of the buffer
+	char* reserve()
+	{
+		if (m_buffer.size() - m_used < FORMAT_MAX) flush();
+		return m_buffer.data() + m_used;
+	}
+
+	void append(const char* text, size_t length);
+
+	std::ostream& m_out;
+	std::vector<char> m_buffer;
+	size_t m_used = 0;
+	int m_decimals = 6;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "arena.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel passes. The calling
+// thread always takes part, so a pool of size 1 has no workers and runs
+// everything inline.
+class ThreadPool
+{
+public:
+	// With pin, every thread including the caller is pinned to the CPU
+	// PinnedCpu gives it, see numa.hpp
+	explicit ThreadPool(unsigned threads, bool pin = false);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned size() const { return static_cast<unsigned>(m_workers.size()) + 1; }
+
+	// Splits [0, count) into size() contiguous chunks and runs f(begin, end)
+	// on each, the caller taking the first. Returns once all are done.
+	// name labels the chunks in the trace and must be a string literal.
+	// f is called through a plain pointer, so no call allocates.
+	template<class F>
+	void parallelFor(size_t count, const F& f, const char* name = "parallel for")
+	{
+		dispatch(count, &ThreadPool::invoke<F>, &f, name);
+	}
+
+private:
+	typedef void (*RangeFn)(const void* job, size_t begin, size_t end);
+
+	template<class F>
+	static void invoke(const void* job, size_t begin, size_t end) { (*static_cast<const F*>(job))(begin, end); }
+
+	void dispatch(size_t count, RangeFn fn, const void* job, const char* name);
+	void run(unsigned index, int cpu);	// cpu -1 leaves the thread unpinned
+	void runChunk(unsigned index);
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_start, m_done;
+
+	RangeFn m_fn = nullptr;
+	const void* m_job = nullptr;
+	const char* m_name = nullptr;
+	size_t m_count = 0;
+	uint64_t m_generation = 0;
+	unsigned m_pending = 0;
+	bool m_stop = false;
+};
+
+// Runs f(begin, end) over [0, count) on pool, or inline when there is none
+template<class F>
+void ParallelFor(ThreadPool* pool, size_t count, const char* name, F f)
+{
+	if (pool) pool->parallelFor(count, f, name);
+	else if (count > 0) f(0, count);
+}
+
+// Reductions split [0, count) into blocks of this many items whatever the
+// pool size, so the partial results and their order never change
+const static size_t REDUCE_BLOCK = 1024;
+
+// Reduces map(begin, end) over the fixed blocks of [0, count) and folds the
+// block results with combine in block order. Floating point results are
+// bit-identical for any number of threads. The block results live in the
+// calling thread's arena.
+template<class T, class Map, class Combine>
+T ParallelReduce(ThreadPool* pool, size_t count, T identity, Map map, Combine combine, const char* name)
+{
+	ArenaScope scope(ThreadArena());
+	size_t blocks = (count + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+	T* partial = ThreadArena().allocate(blocks, identity);
+
+	ParallelFor(pool, blocks, name, [&](size_t begin, size_t end)
+	{
+		for (size_t b = begin; b < end; b++)
+			partial[b] = map(b * REDUCE_BLOCK, std::min(count, (b + 1) * REDUCE_BLOCK));
+	});
+
+	T result = identity;
+	for (size_t b = 0; b < blocks; b++) result = combine(result, partial[b]);
+	return result;
+}
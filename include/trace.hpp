@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+// Opt-in timeline tracing. Begin/end events go to a buffer owned by the
+// calling thread, so recording takes no lock; WriteChromeTrace() merges
+// all buffers into Chrome trace_event JSON (chrome://tracing, Perfetto).
+// While tracing is off a scope costs one relaxed atomic load.
+
+extern std::atomic<bool> g_tracing;
+
+inline bool TracingEnabled()
+{
+	return g_tracing.load(std::memory_order_relaxed);
+}
+
+void EnableTracing(bool enable);
+
+// Names must be string literals or otherwise outlive the trace
+void TraceBegin(const char* name);
+void TraceEnd(const char* name);
+void SetTraceThreadName(const char* name);
+
+// Call once the traced threads have stopped
+bool WriteChromeTrace(const std::string& path, std::string& error);
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name) :
+		m_name(TracingEnabled() ? name : nullptr)
+	{
+		if (m_name) TraceBegin(m_name);
+	}
+
+	~TraceScope()
+	{
+		if (m_name) TraceEnd(m_name);
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* m_name;
+};
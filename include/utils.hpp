@@ -1,7 +1,7 @@
 #pragma once
 
-#include <sstream>
+#include <cstdint>
+#include <string>
 
 std::string to_string(uint32_t number);
 std::string round(double d, int decimals);
-
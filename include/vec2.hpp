@@ -1,145 +1,129 @@
 #pragma once
 
 #include <cmath>
+#include <cstddef>
+#include <type_traits>
 
 namespace up
 {
 
+// Plain pair of floats: 8 bytes, trivially copyable, and arrays of it are
+// interleaved x, y streams the compiler can vectorize over
 struct Vec2
 {
-	Vec2() noexcept :
-		x(0.0f),
-		y(0.0f),
-		m_length(-1.0f)
-	{}
-
-	Vec2(float x, float y) noexcept :
-		x(x),
-		y(y),
-		m_length(-1.0f)
-	{}
-
-	~Vec2() noexcept = default;
-
-	float length() const
-	{
-		if (m_length < 0.0f)
-			m_length = sqrt(x*x + y*y);
-		return m_length;
-	}
+	Vec2() noexcept = default;
+	constexpr Vec2(float x, float y) noexcept : x(x), y(y) {}
 
-	float length2() const
-	{
-		return x*x + y*y;
-	}
+	float length() const { return std::sqrt(x*x + y*y); }
+	float length2() const { return x*x + y*y; }
 
+	// Scales to unit length; a zero vector stays zero
 	void normalize()
 	{
 		float l = length();
-
-		x /= l;
-		y /= l;
-
-		m_length = 1.0f;
-	}
-
-	Vec2 getNormal() const
-	{
-		return Vec2(-y, x);
+		if (l > 0.0f)
+		{
+			x /= l;
+			y /= l;
+		}
 	}
 
-	void operator+=(const Vec2& v)
+	Vec2 normalized() const
 	{
-		x += v.x;
-		y += v.y;
+		Vec2 v = *this;
+		v.normalize();
+		return v;
 	}
 
-	void operator-=(const Vec2& v)
-	{
-		x -= v.x;
-		y -= v.y;
-	}
+	// Rotated a quarter turn counterclockwise
+	Vec2 getNormal() const { return Vec2(-y, x); }
 
-	void operator*=(float f)
-	{
-		x *= f;
-		y *= f;
-	}
+	float dot(const Vec2& v) const { return x*v.x + y*v.y; }
 
-	float dot(const up::Vec2& v) const
-	{
-		return x * v.x + y * v.y;
-	}
+	// z of the 3D cross product
+	float cross(const Vec2& v) const { return x*v.y - y*v.x; }
 
-	float x, y;
+	Vec2& operator+=(const Vec2& v) { x += v.x; y += v.y; return *this; }
+	Vec2& operator-=(const Vec2& v) { x -= v.x; y -= v.y; return *this; }
+	Vec2& operator*=(float f) { x *= f; y *= f; return *this; }
+	Vec2& operator/=(float f) { x /= f; y /= f; return *this; }
 
-private:
-	mutable float m_length;
+	float x = 0.0f, y = 0.0f;
 };
 
-inline Vec2 operator+(const Vec2& v1,const Vec2& v2)
-{
-	return Vec2(v1.x + v2.x, v1.y + v2.y);
-}
+static_assert(sizeof(Vec2) == 2 * sizeof(float), "Vec2 is packed");
+static_assert(std::is_trivially_copyable<Vec2>::value, "Vec2 is copied as raw memory");
 
-inline Vec2 operator-(const Vec2& v1, const Vec2& v2)
-{
-	return Vec2(v1.x - v2.x, v1.y - v2.y);
-}
+inline Vec2 operator+(const Vec2& v) { return v; }
+inline Vec2 operator-(const Vec2& v) { return Vec2(-v.x, -v.y); }
+
+inline Vec2 operator+(const Vec2& v1, const Vec2& v2) { return Vec2(v1.x + v2.x, v1.y + v2.y); }
+inline Vec2 operator-(const Vec2& v1, const Vec2& v2) { return Vec2(v1.x - v2.x, v1.y - v2.y); }
+inline Vec2 operator*(float f, const Vec2& v) { return Vec2(f*v.x, f*v.y); }
+inline Vec2 operator*(const Vec2& v, float f) { return Vec2(f*v.x, f*v.y); }
+inline Vec2 operator/(const Vec2& v, float f) { return Vec2(v.x/f, v.y/f); }
+
+inline bool operator==(const Vec2& v1, const Vec2& v2) { return v1.x == v2.x && v1.y == v2.y; }
+inline bool operator!=(const Vec2& v1, const Vec2& v2) { return !(v1 == v2); }
 
-inline Vec2 operator+(const Vec2& v)
+inline Vec2 getMidPoint(const Vec2& v1, const Vec2& v2)
 {
-	return Vec2(-v.x, -v.y);
+	return (v1 + v2)*0.5f;
 }
 
-inline Vec2 operator*(float f, const Vec2& v)
+// Batched forms over count vectors. The loops carry no state between
+// elements, so they vectorize.
+
+inline void Length2(const Vec2* v, float* out, size_t count)
 {
-	return Vec2(f*v.x, f*v.y);
+	for (size_t i = 0; i < count; i++) out[i] = v[i].x*v[i].x + v[i].y*v[i].y;
 }
 
-inline Vec2 operator*(const Vec2& v, float f)
+inline void Dot(const Vec2* a, const Vec2* b, float* out, size_t count)
 {
-	return Vec2(f*v.x, f*v.y);
+	for (size_t i = 0; i < count; i++) out[i] = a[i].x*b[i].x + a[i].y*b[i].y;
 }
 
-inline const Vec2 getMidPoint(const Vec2& v1, const Vec2& v2)
+// Zero vectors stay zero
+inline void Normalize(Vec2* v, size_t count)
 {
-	return (v1 + v2)*0.5f;
+	for (size_t i = 0; i < count; i++)
+	{
+		float l = std::sqrt(v[i].x*v[i].x + v[i].y*v[i].y);
+		if (l > 0.0f)
+		{
+			v[i].x /= l;
+			v[i].y /= l;
+		}
+	}
 }
 
 struct Segment
 {
 	Segment(const Vec2& p1, const Vec2& p2) :
 		p1(p1),
-		p2(p2)
-	{
-		x = p2.x - p1.x;
-		y = p2.y - p1.y;
-	}
+		p2(p2),
+		d(p2 - p1)
+	{}
 
 	Vec2 p1, p2;
-	float x, y;
+	Vec2 d;		// p2 - p1
 };
 
 struct Intersection
 {
-	Intersection(const Segment& s1, const Segment& s2) :
-		cross(false)
+	Intersection(const Segment& s1, const Segment& s2)
 	{
-		float s1_x(s1.x), s1_y(s1.y), s2_x(s2.x), s2_y(s2.y);
-		float p0_x(s1.p1.x), p0_y(s1.p1.y), p2_x(s2.p1.x), p2_y(s2.p1.y);
-
-		float s, t;
-		s = (-s1_y * (p0_x - p2_x) + s1_x * (p0_y - p2_y)) / (-s2_x * s1_y + s1_x * s2_y);
-		t = (s2_x * (p0_y - p2_y) - s2_y * (p0_x - p2_x)) / (-s2_x * s1_y + s1_x * s2_y);
+		Vec2 between = s1.p1 - s2.p1;
+		float denom = s1.d.cross(s2.d);
+		float s = s1.d.cross(between) / denom;
+		float t = s2.d.cross(between) / denom;
 
 		if (s >= 0 && s <= 1 && t >= 0 && t <= 1)
 		{
-			// Intersection detected
-			point.x = p0_x + (t * s1_x);
-			point.y = p0_y + (t * s1_y);
-
+			point = s1.p1 + t*s1.d;
 			cross = true;
+			this->t = t;
 		}
 	}
 
@@ -147,9 +131,9 @@ struct Intersection
 		Intersection(Segment(p1, p2), Segment(p3, p4))
 	{}
 
-	bool cross;
+	bool cross = false;
 	Vec2 point;
-	float t;
+	float t = 0.0f;	// position of the crossing along s1, in [0, 1]
 };
 
 }
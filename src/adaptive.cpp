@@ -0,0 +1,134 @@
+#include "adaptive.hpp"
+#include "particle_store.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace Eigen;
+
+enum AdaptAction : uint8_t
+{
+	ADAPT_KEEP,
+	ADAPT_SPLIT,
+	ADAPT_MERGE,
+	ADAPT_DONE		// created or consumed in this pass
+};
+
+static bool NearWall(const Simulation& sim, size_t i, float distance)
+{
+	const Particle& p = sim.particles[i];
+	const SimParams& params = sim.params;
+	if(params.walls && !params.periodicX && (p.x(0) <= distance || p.x(0) >= params.viewWidth - distance)) return true;
+	if(params.walls && !params.periodicY && (p.x(1) <= distance || p.x(1) >= params.viewHeight - distance)) return true;
+
+	up::WallContact contact;
+	if(!sim.obstacles.empty() && sim.obstacles.bvh.closest(up::Vec2(p.x(0), p.x(1)), distance, contact)) return true;
+
+	const double DISTANCE2 = double(distance) * distance;
+	bool near = false;
+	sim.grid.forEachNeighbor(i, [&](uint32_t j)
+	{
+		const Particle& pj = sim.particles[j];
+		Vector2d d = pj.x - p.x;
+		sim.grid.period().wrap(d);
+		near = near || (pj.isBoundary && d.squaredNorm() < DISTANCE2);
+	});
+	return near;
+}
+
+void AdaptResolution(Simulation& sim)
+{
+	const SimParams& params = sim.params;
+	const unsigned LEVELS = min(params.adaptLevels, MAX_ADAPT_LEVELS);
+	if(LEVELS == 0 || sim.stepCount % max(params.adaptEvery, 1u) != 0) return;
+
+	const float SPLIT_DENSITY = params.splitDensity * params.restDens;
+	const float MERGE_DENSITY = params.mergeDensity * params.restDens;
+	const float SPLIT_DISTANCE = params.splitDistance;
+	const bool sleeping = params.sleepSpeed > 0.f && sim.cellAsleep.size() == sim.grid.cellCount();
+	const NeighborGrid& grid = sim.grid;
+	vector<Particle>& particles = sim.particles;
+	vector<uint8_t>& action = sim.adaptAction;
+
+	// the grid was built before the particles moved, but indexes them all
+	const size_t n = particles.size();
+	GrowCapacity(action, n);
+	action.assign(n, ADAPT_KEEP);
+
+	ParallelFor(sim.pool, n, "adapt", [&](size_t begin, size_t end)
+	{
+		for(size_t i = begin; i < end; i++)
+		{
+			const Particle& p = particles[i];
+			if(p.isBoundary) continue;
+			if(sleeping && sim.cellAsleep[grid.cellOf(i)]) continue;
+
+			if(p.level < LEVELS && (p.rho < SPLIT_DENSITY || NearWall(sim, i, SPLIT_DISTANCE))) action[i] = ADAPT_SPLIT;
+			else if(p.level > 0 && p.rho > MERGE_DENSITY && !NearWall(sim, i, 2 * SPLIT_DISTANCE)) action[i] = ADAPT_MERGE;
+		}
+	});
+
+	const CounterRng directionRng(params.seed ^ Mix64(sim.stepCount));
+
+	for(size_t i = 0; i < n; i++)
+	{
+		if(action[i] == ADAPT_SPLIT)
+		{
+			// the children sit one child spacing apart, on the parent
+			Particle child = particles[i];
+			child.level++;
+			child.quietSteps = 0;
+
+			double angle = 2.0 * M_PI * directionRng.uniform(i);
+			Vector2d offset = 0.5 * sim.levelH[child.level] * Vector2d(cos(angle), sin(angle));
+			child.x += offset;
+
+			size_t slot = sim.freeSlots.empty() ? particles.size() : sim.freeSlots.back();
+			if(!SpawnParticle(sim, child)) continue;
+			if(slot < n) action[slot] = ADAPT_DONE;
+
+			child.x -= 2.0 * offset;
+			particles[i] = child;
+		}
+		else if(action[i] == ADAPT_MERGE)
+		{
+			Particle& pi = particles[i];
+			const double RANGE2 = double(sim.levelH[pi.level]) * sim.levelH[pi.level];
+
+			int64_t partner = -1;
+			double nearest = RANGE2;
+			Vector2d toPartner;
+			grid.forEachNeighbor(i, [&](uint32_t j)
+			{
+				const Particle& pj = particles[j];
+				Vector2d d = pj.x - pi.x;
+				grid.period().wrap(d);
+				double d2 = d.squaredNorm();
+				if(j != i && action[j] == ADAPT_MERGE && pj.level == pi.level && d2 < nearest)
+				{
+					nearest = d2;
+					partner = j;
+					toPartner = d;
+				}
+			});
+			if(partner < 0) continue;
+
+			// equal masses, so plain means keep the centre of mass and the momentum
+			const Particle& pj = particles[partner];
+			pi.x += 0.5 * toPartner;
+			pi.v = Real(0.5) * (pi.v + pj.v);
+			pi.f = Real(0.5) * (pi.f + pj.f);
+			pi.rho = 0.5f * (pi.rho + pj.rho);
+			pi.p = 0.5f * (pi.p + pj.p);
+			pi.level--;
+			pi.quietSteps = 0;
+
+			action[partner] = ADAPT_DONE;
+			RemoveParticle(sim, partner);
+		}
+		action[i] = ADAPT_DONE;
+	}
+
+	CompactParticles(sim);
+}
@@ -0,0 +1,71 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <utility>
+
+// Blocks are aligned for any type and never smaller than this
+const static size_t MIN_BLOCK = 4096;
+
+Arena::~Arena()
+{
+	for (void* block : m_extra) ::operator delete(block);
+	::operator delete(m_block);
+}
+
+Arena::Arena(Arena&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+Arena& Arena::operator=(Arena&& other) noexcept
+{
+	std::swap(m_block, other.m_block);
+	std::swap(m_size, other.m_size);
+	std::swap(m_used, other.m_used);
+	std::swap(m_extra, other.m_extra);
+	std::swap(m_extraBytes, other.m_extraBytes);
+	std::swap(m_scopes, other.m_scopes);
+	return *this;
+}
+
+void* Arena::allocate(size_t bytes, size_t align)
+{
+	size_t offset = (m_used + align - 1) / align * align;
+	if (m_block && offset + bytes <= m_size)
+	{
+		m_used = offset + bytes;
+		return m_block + offset;
+	}
+
+	// operator new aligns for any fundamental type, enough for everything
+	// stored here
+	void* block = ::operator new(std::max(bytes, size_t(1)));
+	m_extra.push_back(block);
+	m_extraBytes += bytes + align;
+	return block;
+}
+
+void Arena::reset()
+{
+	if (!m_extra.empty())
+	{
+		size_t size = std::max(MIN_BLOCK, m_used + m_extraBytes);
+		for (void* block : m_extra) ::operator delete(block);
+		m_extra.clear();
+		m_extraBytes = 0;
+
+		if (size > m_size)
+		{
+			::operator delete(m_block);
+			m_block = static_cast<char*>(::operator new(size));
+			m_size = size;
+		}
+	}
+	m_used = 0;
+}
+
+Arena& ThreadArena()
+{
+	thread_local Arena arena;
+	return arena;
+}
@@ -0,0 +1,46 @@
+#include "alloc_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replaces the global allocation functions of the bench with counting
+// ones on top of malloc; built into the bench only, so the library and
+// the other tools keep the standard allocator
+
+static std::atomic<uint64_t> g_allocations(0);
+
+uint64_t HeapAllocations()
+{
+	return g_allocations.load(std::memory_order_relaxed);
+}
+
+static void* CountedAlloc(size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new(size_t size)
+{
+	void* p = CountedAlloc(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	void* p = CountedAlloc(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return CountedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return CountedAlloc(size); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations made through operator new since the process started,
+// on all threads: every standard container and new expression. Memory
+// taken with malloc directly, as Eigen does for dynamic sizes, is not
+// counted. Steady-state solver steps make none, see Arena.
+uint64_t HeapAllocations();
@@ -0,0 +1,451 @@
+#include "sph.hpp"
+#include "alloc_counter.hpp"
+#include "ensemble.hpp"
+#include "perf_counters.hpp"
+#include "scene.hpp"
+#include "snapshot.hpp"
+#include "text_writer.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+// Microbenchmarks of the solver building blocks on dam-break layouts of
+// growing size. Every layout comes from a fixed seed, so runs on different
+// builds time exactly the same work.
+
+const static uint64_t BENCH_SEED = 42;
+const static double MIN_SECONDS = 0.2;		// per measurement
+const static int MIN_REPS = 3;
+const static size_t KERNEL_SAMPLES = 1 << 20;
+
+// Column of fluid twice as tall as wide in the left quarter of a tank,
+// with boundary particles along the floor and both side walls. The domain
+// is resized to hold the tank with a margin, so the tank walls rather than
+// the domain edges contain the fluid at every size.
+static void InitDamBreak(Simulation& sim, size_t fluidParticles)
+{
+	sim.particles.clear();
+
+	// the same numbers as Rng(BENCH_SEED), whatever the fill order
+	const CounterRng jitterRng(BENCH_SEED);
+
+	const float H = sim.params.h;
+	const float REST_DENS = sim.params.restDens;
+
+	size_t cols = static_cast<size_t>(ceil(sqrt(fluidParticles / 2.0)));
+	size_t rows = (fluidParticles + cols - 1) / cols;
+	float tankWidth = 4 * cols * H;
+	float floorY = (rows + 1) * H;
+
+	// the tank's left wall sits at x = H and the top of the column at y = 2H
+	const float MARGIN = 2 * H;
+	sim.params.viewWidth = tankWidth + 2 * MARGIN;
+	sim.params.viewHeight = floorY + 2 * MARGIN;
+
+	for (size_t i = 0; i < fluidParticles; i++)
+	{
+		float jitter = jitterRng.uniform(i);
+		sim.particles.push_back(Particle(MARGIN + (i % cols) * H + jitter, MARGIN + (i / cols) * H, REST_DENS, false));
+	}
+
+	for (float x = -H; x <= tankWidth; x += H)
+		sim.particles.push_back(Particle(MARGIN + x, MARGIN + floorY, REST_DENS, true));
+	for (float y = 0.f; y < floorY; y += H)
+	{
+		sim.particles.push_back(Particle(MARGIN - H, MARGIN + y, REST_DENS, true));
+		sim.particles.push_back(Particle(MARGIN + tankWidth, MARGIN + y, REST_DENS, true));
+	}
+}
+
+struct Timing
+{
+	double ns;			// best time of one call
+	double counts[PERF_COUNTER_COUNT];	// hardware counts per call, zero when unavailable
+};
+
+template<class F>
+static Timing Time(F f)
+{
+	Timing timing;
+	double total = 0.0;
+	int reps = 0;
+
+	timing.ns = 1e300;
+
+	PerfCounts start, end;
+	ReadPerfCounters(start);
+
+	for (; reps < MIN_REPS || total < MIN_SECONDS * 1e9; reps++)
+	{
+		auto begin = chrono::steady_clock::now();
+		f();
+		double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count();
+		timing.ns = min(timing.ns, ns);
+		total += ns;
+	}
+
+	ReadPerfCounters(end);
+	for (int c = 0; c < PERF_COUNTER_COUNT; c++) timing.counts[c] = static_cast<double>(end.values[c] - start.values[c]) / reps;
+
+	return timing;
+}
+
+template<class F>
+static double TimeNs(F f)
+{
+	return Time(f).ns;
+}
+
+// Ordered pairs within the kernel support, as visited by the density and force passes
+static size_t CountPairs(const Simulation& sim)
+{
+	const float SUPPORT = sim.kernel.support;
+	size_t pairs = 0;
+	for (size_t i = 0; i < sim.particles.size(); i++)
+	{
+		if (sim.particles[i].isBoundary) continue;
+		sim.grid.forEachNeighbor(i, [&](uint32_t j)
+		{
+			if ((sim.particles[j].x - sim.particles[i].x).norm() < SUPPORT) pairs++;
+		});
+	}
+	return pairs;
+}
+
+static void BenchKernels(TextWriter* csv)
+{
+	const Kernel kernel;
+	vector<float> distances(KERNEL_SAMPLES);
+	vector<Vector2r> directions(KERNEL_SAMPLES);
+	Rng rng(BENCH_SEED);
+	for (size_t i = 0; i < KERNEL_SAMPLES; i++)
+	{
+		distances[i] = rng.uniform() * 1.1f * kernel.support;
+		float angle = rng.uniform() * 2.f * M_PI;
+		directions[i] = Vector2r(cos(angle), sin(angle));
+	}
+
+	volatile double sink = 0.0;
+
+	double kernelNs = TimeNs([&]
+	{
+		double sum = 0.0;
+		for (size_t i = 0; i < KERNEL_SAMPLES; i++) sum += KernelFunction(kernel, distances[i]);
+		sink = sink + sum;
+	}) / KERNEL_SAMPLES;
+
+	double derivativeNs = TimeNs([&]
+	{
+		double sum = 0.0;
+		for (size_t i = 0; i < KERNEL_SAMPLES; i++) sum += KernelFirstDerivativeFunction(kernel, directions[i], distances[i])(0);
+		sink = sink + sum;
+	}) / KERNEL_SAMPLES;
+
+	cout << "KernelFunction                 " << setw(8) << kernelNs << " ns/call" << endl;
+	cout << "KernelFirstDerivativeFunction  " << setw(8) << derivativeNs << " ns/call" << endl;
+
+	if (csv)
+	{
+		*csv << "kernel,0,0," << kernelNs << ",0,0,0,0,0,0\n";
+		*csv << "kernel_derivative,0,0," << derivativeNs << ",0,0,0,0,0,0\n";
+	}
+}
+
+static void BenchPasses(size_t fluidParticles, ThreadPool* pool, TextWriter* csv)
+{
+	Simulation sim;
+	sim.pool = pool;
+	InitDamBreak(sim, fluidParticles);
+	size_t n = sim.particles.size();
+
+	// warm up so density and pressure are meaningful before timing forces
+	NeighborSearch(sim);
+	CalculateDensityPressure(sim);
+	size_t pairs = CountPairs(sim);
+
+	struct { const char* name; Timing timing; } passes[] =
+	{
+		{ "neighbors", Time([&] { NeighborSearch(sim); }) },
+		{ "density", Time([&] { CalculateDensityPressure(sim); }) },
+		{ "forces", Time([&] { CalculateForces(sim); }) },
+	};
+
+	for (const auto& pass : passes)
+	{
+		const Timing& t = pass.timing;
+		double nsPerParticle = t.ns / n;
+		double pairsPerSecond = pairs / (t.ns * 1e-9);
+
+		cout << setw(10) << n << "  " << left << setw(10) << pass.name << right
+			<< setw(12) << nsPerParticle << " ns/particle" << setw(14) << pairsPerSecond / 1e6 << " Mpairs/s";
+
+		if (PerfCountersEnabled())
+		{
+			if (t.counts[PERF_CYCLES] > 0) cout << setw(8) << t.counts[PERF_INSTRUCTIONS] / t.counts[PERF_CYCLES] << " IPC";
+			cout << setw(8) << t.counts[PERF_L1D_MISSES] / n << " L1D/particle"
+				<< setw(8) << t.counts[PERF_LLC_MISSES] / n << " LLC/particle";
+		}
+		cout << endl;
+
+		if (csv)
+		{
+			*csv << pass.name << "," << n << "," << pairs << "," << nsPerParticle << "," << pairsPerSecond;
+			for (int c = 0; c < PERF_COUNTER_COUNT; c++) *csv << "," << t.counts[c] / n;
+			*csv << "\n";
+		}
+	}
+}
+
+// The default scene, members times: stepped one simulation after another,
+// and as one ensemble
+static bool BenchEnsemble(size_t members, ThreadPool* pool, TextWriter* csv)
+{
+	Scene scene;
+
+	Ensemble ensemble;
+	string error;
+	if (!SetupEnsemble(ensemble, scene, members, error))
+	{
+		cout << "Cannot set up the ensemble: " << error << endl;
+		return false;
+	}
+	ensemble.pool = pool;
+
+	// the same layouts as the members; copies of one layout would repeat
+	// the same branches over and over and flatter the separate steps
+	vector<Simulation> sims(members);
+	for (size_t m = 0; m < members; m++)
+	{
+		Scene member = scene;
+		member.params.seed = scene.params.seed + m;
+		SetupSimulation(sims[m], member);
+		sims[m].pool = pool;
+	}
+
+	// alternating steps, so both sides see the same noise and the same
+	// stage of the dam break
+	size_t n = ensemble.size();
+	double separateNs = 1e300, ensembleNs = 1e300, total = 0.0;
+	for (int rep = 0; rep < MIN_REPS || total < 2 * MIN_SECONDS * 1e9; rep++)
+	{
+		auto begin = chrono::steady_clock::now();
+		for (Simulation& sim : sims) Step(sim);
+		auto middle = chrono::steady_clock::now();
+		StepEnsemble(ensemble);
+		auto end = chrono::steady_clock::now();
+
+		separateNs = min(separateNs, chrono::duration<double, nano>(middle - begin).count());
+		ensembleNs = min(ensembleNs, chrono::duration<double, nano>(end - middle).count());
+		total += chrono::duration<double, nano>(end - begin).count();
+	}
+
+	cout << setw(10) << n << "  " << left << setw(10) << "separate" << right << setw(12) << separateNs / n << " ns/particle" << endl;
+	cout << setw(10) << n << "  " << left << setw(10) << "ensemble" << right << setw(12) << ensembleNs / n << " ns/particle" << endl;
+
+	if (csv)
+	{
+		*csv << "step_separate," << n << ",0," << separateNs / n << ",0,0,0,0,0,0\n";
+		*csv << "step_ensemble," << n << ",0," << ensembleNs / n << ",0,0,0,0,0,0\n";
+	}
+	return true;
+}
+
+// Runs a dam break on pools of 1 to maxThreads threads and compares the
+// final states bit for bit. InitDamBreak jitters with a CounterRng, so
+// the layout is the same on every run without the deterministic switch,
+// which only InitParticles reads
+static bool CheckDeterminism(size_t fluidParticles, unsigned maxThreads)
+{
+	const int STEPS = 200;
+	uint64_t reference = 0;
+	bool identical = true;
+
+	for (unsigned threads = 1; threads <= maxThreads; threads++)
+	{
+		ThreadPool pool(threads);
+		Simulation sim;
+		sim.pool = &pool;
+		InitDamBreak(sim, fluidParticles);
+
+		for (int i = 0; i < STEPS; i++) Step(sim);
+
+		uint64_t hash = StateHash(sim);
+		SimDiagnostics d = Diagnose(sim);
+		if (threads == 1) reference = hash;
+		identical = identical && hash == reference;
+
+		cout << setw(3) << threads << " threads  state " << hex << setw(16) << setfill('0') << hash << dec << setfill(' ')
+			<< "  kinetic energy " << setprecision(17) << d.kineticEnergy << setprecision(2)
+			<< (hash == reference ? "" : "  MISMATCH") << endl;
+	}
+
+	return identical;
+}
+
+// Dumps a stepped dam break as full-frame CSV, once through TextWriter and
+// once through ostream, into a sink that discards the text
+static void BenchFormatting(size_t fluidParticles)
+{
+	const int STEPS = 5;		// enough for every attribute to vary
+
+	Simulation sim;
+	InitDamBreak(sim, fluidParticles);
+	for (int i = 0; i < STEPS; i++) Step(sim);
+
+	SnapshotFrame frame;
+	frame.resize(sim.particles.size());
+	for (size_t i = 0; i < frame.size(); i++)
+	{
+		const Particle& pi = sim.particles[i];
+		frame.x[i] = pi.x(0);
+		frame.y[i] = pi.x(1);
+		frame.vx[i] = pi.v(0);
+		frame.vy[i] = pi.v(1);
+		frame.rho[i] = pi.rho;
+		frame.p[i] = pi.p;
+		frame.flags[i] = pi.isBoundary ? SNAP_FLAG_BOUNDARY : 0;
+	}
+
+	ostringstream text;
+	{
+		TextWriter out(text);
+		WriteFrameCsv(out, frame);
+	}
+	size_t bytes = text.str().size();
+
+	ofstream sink("/dev/null");
+
+	double writerNs = TimeNs([&]
+	{
+		TextWriter out(sink);
+		WriteFrameCsv(out, frame);
+	});
+
+	double streamNs = TimeNs([&]
+	{
+		sink << fixed << setprecision(6) << "x,y,vx,vy,rho,p,flags\n";
+		for (size_t i = 0; i < frame.size(); i++)
+		{
+			sink << frame.x[i] << "," << frame.y[i] << "," << frame.vx[i] << "," << frame.vy[i] << ","
+				<< frame.rho[i] << "," << frame.p[i] << "," << unsigned(frame.flags[i]) << "\n";
+		}
+	});
+
+	size_t n = frame.size();
+	cout << n << " particles, " << bytes << " bytes per frame" << endl;
+	cout << left << setw(12) << "TextWriter" << right << setw(10) << writerNs / n << " ns/particle" << setw(10) << bytes / writerNs * 1e3 << " MB/s" << endl;
+	cout << left << setw(12) << "ostream" << right << setw(10) << streamNs / n << " ns/particle" << setw(10) << bytes / streamNs * 1e3 << " MB/s" << endl;
+}
+
+// Steps a dam break until its buffers have grown, then counts the heap
+// allocations of further steps and diagnostics, which should be none
+static bool CheckAllocations(size_t fluidParticles, unsigned threads)
+{
+	const int WARMUP = 300, STEPS = 400;	// each spans a balancing measurement
+
+	ThreadPool pool(threads);
+	Simulation sim;
+	sim.pool = &pool;
+	InitDamBreak(sim, fluidParticles);
+
+	for (int i = 0; i < WARMUP; i++)
+	{
+		Step(sim);
+		Diagnose(sim);
+	}
+
+	uint64_t before = HeapAllocations();
+	for (int i = 0; i < STEPS; i++)
+	{
+		Step(sim);
+		Diagnose(sim);
+	}
+	uint64_t allocations = HeapAllocations() - before;
+
+	cout << allocations << " heap allocations in " << STEPS << " steps on " << threads << " threads" << endl;
+	return allocations == 0;
+}
+
+int main(int argc, char** argv)
+{
+	size_t minParticles = 1000, maxParticles = 1000000;
+	string csvPath;
+	bool perfCounters = false;
+	unsigned threads = 1;
+	size_t members = 0;
+	bool determinism = false;
+	bool allocations = false;
+	bool formatting = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--min" && i + 1 < argc) minParticles = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--max" && i + 1 < argc) maxParticles = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--csv" && i + 1 < argc) csvPath = argv[++i];
+		else if (arg == "--perf-counters") perfCounters = true;
+		else if (arg == "--threads" && i + 1 < argc) threads = strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--ensemble" && i + 1 < argc) members = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--determinism") determinism = true;
+		else if (arg == "--allocations") allocations = true;
+		else if (arg == "--formatting") formatting = true;
+		else {
+			cout << "Usage: " << argv[0] << " [--min particles] [--max particles] [--csv file] [--perf-counters] [--threads n] [--ensemble members] [--determinism] [--allocations] [--formatting]" << endl;
+			return 1;
+		}
+	}
+
+	ofstream csvFile;
+	unique_ptr<TextWriter> csvWriter;
+	TextWriter* csv = nullptr;
+	if (!csvPath.empty())
+	{
+		csvFile.open(csvPath);
+		if (!csvFile.is_open())
+		{
+			cout << "Cannot open " << csvPath << endl;
+			return 1;
+		}
+		csvWriter.reset(new TextWriter(csvFile));
+		csv = csvWriter.get();
+		csv->precision(3);
+		*csv << "benchmark,particles,pairs,ns_per_item,pairs_per_second,"
+			"cycles_per_particle,instructions_per_particle,l1d_misses_per_particle,llc_misses_per_particle,branch_misses_per_particle\n";
+	}
+
+	// --threads is the largest pool to compare, --min the scene size
+	if (determinism) return CheckDeterminism(minParticles, max(threads, 4u)) ? 0 : 1;
+	if (allocations) return CheckAllocations(minParticles, threads) ? 0 : 1;
+
+	cout << fixed << setprecision(2);
+
+	if (formatting)
+	{
+		BenchFormatting(minParticles);
+		return 0;
+	}
+
+	unique_ptr<ThreadPool> pool;
+	if (threads > 1) pool.reset(new ThreadPool(threads));
+
+	// counted on every thread of the pool, the passes spread over all
+	string perfError;
+	if (perfCounters && !EnablePerfCounters(perfError, pool.get())) cout << "Hardware counters unavailable: " << perfError << endl;
+
+	BenchKernels(csv);
+	for (size_t n = minParticles; n <= maxParticles; n *= 10) BenchPasses(n, pool.get(), csv);
+	if (members > 0 && !BenchEnsemble(members, pool.get(), csv)) return 1;
+
+	return 0;
+}
@@ -0,0 +1,146 @@
+#include "checkpoint.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char CHECKPOINT_MAGIC[8] = { 'F', 'S', 'I', 'M', 'C', 'K', 'P', 'T' };
+
+// Writes all of data, retrying short writes and interruptions
+static bool WriteAll(int fd, const void* data, size_t length)
+{
+	const char* bytes = static_cast<const char*>(data);
+	while (length > 0)
+	{
+		ssize_t n = write(fd, bytes, length);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		bytes += n;
+		length -= n;
+	}
+	return true;
+}
+
+bool SaveCheckpoint(const std::string& path, const CheckpointHeader& header,
+	const std::vector<CheckpointParticle>& particles, const std::vector<CheckpointEmitter>& emitters, std::string& error)
+{
+	CheckpointHeader h = header;
+	memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+	h.version = CHECKPOINT_VERSION;
+	h.headerSize = sizeof(CheckpointHeader);
+	h.particleSize = sizeof(CheckpointParticle);
+	h.emitterCount = static_cast<uint32_t>(emitters.size());
+	h.padding = 0;
+	h.particleCount = particles.size();
+
+	std::string tmpPath = path + ".tmp";
+	int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		error = "cannot open " + tmpPath;
+		return false;
+	}
+
+	// the data reaches the disk before the rename can expose it
+	bool written = WriteAll(fd, &h, sizeof(h)) &&
+		WriteAll(fd, particles.data(), particles.size() * sizeof(CheckpointParticle)) &&
+		WriteAll(fd, emitters.data(), emitters.size() * sizeof(CheckpointEmitter)) &&
+		fsync(fd) == 0;
+	if (::close(fd) != 0 || !written)
+	{
+		error = "cannot write " + tmpPath;
+		return false;
+	}
+
+	if (rename(tmpPath.c_str(), path.c_str()) != 0)
+	{
+		error = "cannot move " + tmpPath + " to " + path;
+		return false;
+	}
+
+	// and the rename itself survives a power loss
+	size_t slash = path.find_last_of('/');
+	std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+	int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+	bool synced = dirFd >= 0 && fsync(dirFd) == 0;
+	if (dirFd >= 0) ::close(dirFd);
+	if (!synced)
+	{
+		error = "cannot sync " + directory;
+		return false;
+	}
+
+	return true;
+}
+
+CheckpointReader::~CheckpointReader()
+{
+	close();
+}
+
+bool CheckpointReader::open(const std::string& path, std::string& error)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(CheckpointHeader)))
+	{
+		::close(fd);
+		error = path + " is too small to be a checkpoint";
+		return false;
+	}
+
+	void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+	{
+		error = "cannot map " + path;
+		return false;
+	}
+
+	m_data = static_cast<const uint8_t*>(data);
+	m_size = st.st_size;
+	memcpy(&m_header, m_data, sizeof(m_header));
+
+	// error may hold an earlier message, so only a local one decides
+	std::string failure;
+	if (memcmp(m_header.magic, CHECKPOINT_MAGIC, sizeof(m_header.magic)) != 0 || m_header.headerSize != sizeof(CheckpointHeader))
+		failure = path + " is not a checkpoint file";
+	else if (m_header.version != CHECKPOINT_VERSION || m_header.particleSize != sizeof(CheckpointParticle))
+		error = path + " has unsupported checkpoint version " + std::to_string(m_header.version);
+	else if (m_header.particleCount > m_size || sizeof(CheckpointHeader) + m_header.particleCount * sizeof(CheckpointParticle)
+		+ uint64_t(m_header.emitterCount) * sizeof(CheckpointEmitter) != m_size)
+		failure = path + " is truncated";
+
+	if (!failure.empty())
+	{
+		error = failure;
+		close();
+		return false;
+	}
+
+	m_particles = reinterpret_cast<const CheckpointParticle*>(m_data + sizeof(CheckpointHeader));
+	m_emitters = reinterpret_cast<const CheckpointEmitter*>(m_particles + m_header.particleCount);
+	return true;
+}
+
+void CheckpointReader::close()
+{
+	if (m_data) munmap(const_cast<uint8_t*>(m_data), m_size);
+	m_data = nullptr;
+	m_size = 0;
+	m_particles = nullptr;
+	m_emitters = nullptr;
+}
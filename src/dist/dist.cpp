@@ -0,0 +1,294 @@
+#include "distributed.hpp"
+#include "scene.hpp"
+#include "thread_pool.hpp"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Runs one scene split into x slabs over several processes on this machine,
+// see distributed.hpp. Rank 0 is this process, the others are forked and
+// linked to their neighbors by socket pairs. At the end every rank sends
+// its particles and counters to rank 0, which prints the merged state.
+
+// What each rank reports at the end, followed by its particles
+struct RankStats
+{
+	double left, right;
+	double cpuSeconds;
+	uint64_t owned, migrated, rebalances;
+};
+
+static double CpuSeconds()
+{
+	timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void PrintDiagnostics(const char* label, const Simulation& sim)
+{
+	SimDiagnostics d = Diagnose(sim);
+	printf("%s: fluid %zu  mean density %.6f  max density %.6f  max speed %.4f  kinetic energy %.6g%s\n",
+		label, d.fluidCount, d.meanDensity, d.maxDensity, d.maxSpeed, d.kineticEnergy, d.finite ? "" : "  NOT FINITE");
+}
+
+// Closes every socket end in fds except those in keep. Each process holds
+// only its own ends, so a rank that exits leaves its peers an EOF rather
+// than a link that stays silent forever.
+static void CloseExcept(vector<int>& fds, const vector<int>& keep)
+{
+	for (int& fd : fds)
+		if (fd >= 0 && find(keep.begin(), keep.end(), fd) == keep.end())
+		{
+			close(fd);
+			fd = -1;
+		}
+}
+
+// Advances this rank's slab and reports to rank 0 over control, or into
+// stats and sim when this is rank 0
+static bool RunRank(const Scene& scene, Slab& slab, uint64_t steps, unsigned threads, Simulation& sim, RankStats& stats, string& error)
+{
+	unique_ptr<ThreadPool> pool;
+	if (threads > 1) pool.reset(new ThreadPool(threads, NumaEnabled(scene.pinThreads)));
+
+	SetupSimulation(sim, scene);
+	sim.pool = pool.get();
+	KeepSlab(sim, slab);
+	if (NumaEnabled(scene.firstTouch)) PlaceParticles(sim);
+
+	double start = CpuSeconds();
+	for (uint64_t s = 0; s < steps; s++)
+		if (!StepSlab(sim, slab, error)) return false;
+
+	DropHalos(sim);
+	sim.pool = nullptr;
+
+	stats.left = slab.left;
+	stats.right = slab.right;
+	stats.cpuSeconds = CpuSeconds() - start;
+	stats.owned = sim.particles.size();
+	stats.migrated = slab.migrated;
+	stats.rebalances = slab.rebalances;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	string scenePath = "../res/default.scene";
+	vector<string> overrides;
+	unsigned ranks = 2, threads = 1, rebalanceEvery = 50;
+	uint64_t steps = 1000;
+	bool verify = false;
+	string error;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--scene" && i + 1 < argc) scenePath = argv[++i];
+		else if (arg == "--set" && i + 1 < argc) overrides.push_back(argv[++i]);
+		else if (arg == "--ranks" && i + 1 < argc) ranks = max(1ul, strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--steps" && i + 1 < argc) steps = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--rebalance-every" && i + 1 < argc) rebalanceEvery = strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--threads" && i + 1 < argc) threads = max(1ul, strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--verify") verify = true;
+		else {
+			cout << "Usage: " << argv[0] << " [--scene file] [--set key=value]... [--ranks n] [--steps n]"
+				" [--rebalance-every n] [--threads n] [--verify]" << endl;
+			return 1;
+		}
+	}
+
+	Scene scene;
+	SceneLoad sceneLoad = LoadScene(scenePath, scene, error);
+	if (sceneLoad == SceneLoad::Missing) cout << "Using the default scene: " << error << endl;
+	else if (sceneLoad == SceneLoad::Invalid)
+	{
+		cout << error << endl;
+		return 1;
+	}
+
+	for (const string& assignment : overrides)
+	{
+		if (!SetSceneOverride(scene, assignment, error))
+		{
+			cout << error << endl;
+			return 1;
+		}
+	}
+
+	if (scene.params.periodicX)
+	{
+		cout << "Periodic x axes cannot be split into slabs" << endl;
+		return 1;
+	}
+	if (!scene.emitters.empty() || !scene.sinks.empty() || scene.params.adaptLevels > 0)
+	{
+		cout << "Ignoring the emitters, sinks and adaptive levels of the scene" << endl;
+		scene.emitters.clear();
+		scene.sinks.clear();
+		scene.params.adaptLevels = 0;
+	}
+	scene.maxParticles = 0;
+
+	// every rank cuts the same initial layout
+	Simulation layout;
+	SetupSimulation(layout, scene);
+	vector<double> borders = SlabBorders(layout, ranks);
+
+	// links[r] joins rank r and r + 1, control[r] joins rank r and rank 0
+	vector<int> links(2 * ranks, -1), control(2 * ranks, -1);
+	for (unsigned r = 0; r + 1 < ranks; r++)
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, &links[2 * r]) != 0)
+		{
+			perror("socketpair");
+			return 1;
+		}
+	for (unsigned r = 1; r < ranks; r++)
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, &control[2 * r]) != 0)
+		{
+			perror("socketpair");
+			return 1;
+		}
+
+	auto slabOf = [&](unsigned rank)
+	{
+		Slab slab;
+		slab.rank = rank;
+		slab.ranks = ranks;
+		slab.left = rank == 0 ? -HUGE_VAL : borders[rank - 1];
+		slab.right = rank + 1 == ranks ? HUGE_VAL : borders[rank];
+		slab.leftLink = rank == 0 ? -1 : links[2 * (rank - 1) + 1];
+		slab.rightLink = rank + 1 == ranks ? -1 : links[2 * rank];
+		slab.rebalanceEvery = rebalanceEvery;
+		return slab;
+	};
+
+	cout << "Running " << steps << " steps of " << layout.particles.size() << " particles on " << ranks << " ranks" << endl;
+
+	vector<pid_t> children;
+	for (unsigned r = 1; r < ranks; r++)
+	{
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			perror("fork");
+			return 1;
+		}
+		if (pid > 0)
+		{
+			children.push_back(pid);
+			continue;
+		}
+
+		Slab slab = slabOf(r);
+		CloseExcept(links, { slab.leftLink, slab.rightLink });
+		CloseExcept(control, { control[2 * r + 1] });
+
+		Simulation sim;
+		RankStats stats;
+		if (!RunRank(scene, slab, steps, threads, sim, stats, error))
+		{
+			fprintf(stderr, "rank %u: %s\n", r, error.c_str());
+			_exit(1);
+		}
+
+		vector<uint8_t> report(sizeof(stats));
+		memcpy(report.data(), &stats, sizeof(stats));
+		PackParticles(sim, 0, sim.particles.size(), report);
+		if (!SendMessage(control[2 * r + 1], report, error))
+		{
+			fprintf(stderr, "rank %u: %s\n", r, error.c_str());
+			_exit(1);
+		}
+		_exit(0);
+	}
+
+	// the children hold their own ends now
+	Slab slab = slabOf(0);
+	CloseExcept(links, { slab.rightLink });
+	for (unsigned r = 1; r < ranks; r++)
+	{
+		close(control[2 * r + 1]);
+		control[2 * r + 1] = -1;
+	}
+
+	Simulation merged;
+	vector<RankStats> stats(ranks);
+	bool ok = RunRank(scene, slab, steps, threads, merged, stats[0], error);
+	if (!ok) cout << "rank 0: " << error << endl;
+
+	// a failed rank 0 must not leave rank 1 waiting on its link
+	CloseExcept(links, {});
+
+	for (unsigned r = 1; ok && r < ranks; r++)
+	{
+		vector<uint8_t> report;
+		if (!ReceiveMessage(control[2 * r], report, error) || report.size() < sizeof(RankStats))
+		{
+			cout << "rank " << r << ": no report" << (error.empty() ? "" : ", " + error) << endl;
+			ok = false;
+			break;
+		}
+		memcpy(&stats[r], report.data(), sizeof(RankStats));
+		UnpackParticles(report, sizeof(RankStats), merged);
+	}
+
+	for (pid_t pid : children)
+	{
+		int status;
+		waitpid(pid, &status, 0);
+		ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+	if (!ok) return 1;
+
+	for (unsigned r = 0; r < ranks; r++)
+		printf("rank %u: x [%.2f, %.2f)  owned %llu  migrated %llu  rebalances %llu  cpu %.3f s\n",
+			r, stats[r].left, stats[r].right, (unsigned long long)stats[r].owned,
+			(unsigned long long)stats[r].migrated, (unsigned long long)stats[r].rebalances, stats[r].cpuSeconds);
+	PrintDiagnostics("slabs", merged);
+
+	if (verify)
+	{
+		unique_ptr<ThreadPool> pool;
+		if (threads > 1) pool.reset(new ThreadPool(threads));
+
+		Simulation reference;
+		SetupSimulation(reference, scene);
+		reference.pool = pool.get();
+
+		double start = CpuSeconds();
+		for (uint64_t s = 0; s < steps; s++) Step(reference);
+		printf("single process: %.3f s\n", CpuSeconds() - start);
+		PrintDiagnostics("reference", reference);
+
+		// the slabs sum neighbors in another order, so states drift apart
+		// by rounding; compare positions in a common order
+		auto byPosition = [](const Particle& a, const Particle& b) { return a.x(0) < b.x(0) || (a.x(0) == b.x(0) && a.x(1) < b.x(1)); };
+		vector<Particle> a = merged.particles, b = reference.particles;
+		sort(a.begin(), a.end(), byPosition);
+		sort(b.begin(), b.end(), byPosition);
+		if (a.size() != b.size()) printf("particle counts differ: %zu and %zu\n", a.size(), b.size());
+		else
+		{
+			double maxDistance = 0.0;
+			for (size_t i = 0; i < a.size(); i++) maxDistance = max(maxDistance, (a[i].x - b[i].x).norm());
+			printf("max position difference %.6g\n", maxDistance);
+		}
+	}
+	return 0;
+}
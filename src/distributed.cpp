@@ -0,0 +1,465 @@
+#include "distributed.hpp"
+#include "particle_store.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <limits>
+
+using namespace std;
+using namespace Eigen;
+
+// Particle as sent between ranks, which run the same build
+#pragma pack(push, 1)
+struct WireParticle
+{
+	double x[2];
+	Real v[2], f[2];
+	float rho, p;
+	uint8_t isBoundary, level;
+	uint16_t quietSteps;
+};
+
+// Densities and pressures of the halos, refreshed after the density pass
+struct WireState
+{
+	float rho, p;
+};
+
+#pragma pack(pop)
+
+// Slabs keep this many kernel supports of width
+const static double MIN_SLAB_SUPPORTS = 2.0;
+
+// A border moves by this fraction of the transfer that would even out the
+// measured loads, so noisy timings do not make it swing back and forth
+const static double REBALANCE_DAMPING = 0.5;
+
+// Imbalances below this fraction of the pair's load are left alone
+const static double REBALANCE_TOLERANCE = 0.05;
+
+static double CpuSeconds()
+{
+	timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+template<class T>
+static void Append(vector<uint8_t>& message, const T& value)
+{
+	size_t at = message.size();
+	message.resize(at + sizeof(T));
+	memcpy(message.data() + at, &value, sizeof(T));
+}
+
+template<class T>
+static T Read(const vector<uint8_t>& message, size_t index)
+{
+	T value;
+	memcpy(&value, message.data() + index * sizeof(T), sizeof(T));
+	return value;
+}
+
+static WireParticle ToWire(const Particle& p)
+{
+	WireParticle w;
+	w.x[0] = p.x(0); w.x[1] = p.x(1);
+	w.v[0] = p.v(0); w.v[1] = p.v(1);
+	w.f[0] = p.f(0); w.f[1] = p.f(1);
+	w.rho = p.rho;
+	w.p = p.p;
+	w.isBoundary = p.isBoundary;
+	w.level = p.level;
+	w.quietSteps = p.quietSteps;
+	return w;
+}
+
+static Particle FromWire(const WireParticle& w)
+{
+	Particle p(0.f, 0.f, w.rho, w.isBoundary != 0);
+	p.x = Vector2d(w.x[0], w.x[1]);
+	p.v = Vector2r(w.v[0], w.v[1]);
+	p.f = Vector2r(w.f[0], w.f[1]);
+	p.p = w.p;
+	p.level = w.level;
+	p.quietSteps = w.quietSteps;
+	return p;
+}
+
+void PackParticles(const Simulation& sim, size_t begin, size_t end, vector<uint8_t>& message)
+{
+	for (size_t i = begin; i < end; i++) Append(message, ToWire(sim.particles[i]));
+}
+
+void UnpackParticles(const vector<uint8_t>& message, size_t offset, Simulation& sim)
+{
+	size_t count = (message.size() - offset) / sizeof(WireParticle);
+	for (size_t i = 0; i < count; i++)
+	{
+		WireParticle w;
+		memcpy(&w, message.data() + offset + i * sizeof(WireParticle), sizeof(WireParticle));
+		sim.particles.push_back(FromWire(w));
+	}
+}
+
+static bool LinkError(const char* what, string& error)
+{
+	error = string(what) + ": " + (errno ? strerror(errno) : "connection closed");
+	return false;
+}
+
+bool SendMessage(int fd, const vector<uint8_t>& message, string& error)
+{
+	uint64_t size = message.size();
+	const uint8_t* parts[2] = { reinterpret_cast<const uint8_t*>(&size), message.data() };
+	size_t lengths[2] = { sizeof(size), message.size() };
+
+	for (int k = 0; k < 2; k++)
+		for (size_t done = 0; done < lengths[k];)
+		{
+			ssize_t n = send(fd, parts[k] + done, lengths[k] - done, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return LinkError("send", error);
+			done += n;
+		}
+	return true;
+}
+
+static bool ReceiveBytes(int fd, void* data, size_t size, string& error)
+{
+	for (size_t done = 0; done < size;)
+	{
+		errno = 0;
+		ssize_t n = recv(fd, static_cast<uint8_t*>(data) + done, size - done, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return LinkError("receive", error);
+		done += n;
+	}
+	return true;
+}
+
+bool ReceiveMessage(int fd, vector<uint8_t>& message, string& error)
+{
+	uint64_t size;
+	if (!ReceiveBytes(fd, &size, sizeof(size), error)) return false;
+	message.resize(size);
+	return ReceiveBytes(fd, message.data(), size, error);
+}
+
+// One message each way over one link
+struct Transfer
+{
+	int fd;
+	const vector<uint8_t>* out;
+	vector<uint8_t>* in;
+
+	uint64_t outSize, inSize;
+	size_t sent, received;		// including the size prefix
+};
+
+// Sends and receives on all links at once. Sending first and receiving
+// after could deadlock two ranks whose messages both outgrow the socket
+// buffers.
+static bool Exchange(Transfer* transfers, int count, string& error)
+{
+	const size_t PREFIX = sizeof(uint64_t);
+
+	for (int t = 0; t < count; t++)
+	{
+		transfers[t].outSize = transfers[t].out->size();
+		transfers[t].sent = transfers[t].received = 0;
+	}
+
+	while (true)
+	{
+		pollfd fds[2];
+		int waiting = 0;
+		for (int t = 0; t < count; t++)
+		{
+			Transfer& x = transfers[t];
+			bool sending = x.sent < PREFIX + x.outSize;
+			bool receiving = x.received < PREFIX || x.received < PREFIX + x.inSize;
+			fds[t].fd = x.fd;
+			fds[t].events = (sending ? POLLOUT : 0) | (receiving ? POLLIN : 0);
+			fds[t].revents = 0;
+			waiting += sending || receiving;
+		}
+		if (waiting == 0) return true;
+
+		if (poll(fds, count, -1) < 0)
+		{
+			if (errno == EINTR) continue;
+			return LinkError("poll", error);
+		}
+
+		for (int t = 0; t < count; t++)
+		{
+			Transfer& x = transfers[t];
+
+			if (fds[t].revents & POLLOUT)
+			{
+				const uint8_t* data = x.sent < PREFIX ? reinterpret_cast<const uint8_t*>(&x.outSize) + x.sent : x.out->data() + (x.sent - PREFIX);
+				size_t length = x.sent < PREFIX ? PREFIX - x.sent : x.outSize - (x.sent - PREFIX);
+
+				ssize_t n = send(x.fd, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+				if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+				if (n <= 0) return LinkError("send", error);
+				x.sent += n;
+			}
+
+			if (fds[t].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+				if (x.received < PREFIX)
+				{
+					errno = 0;
+					ssize_t n = recv(x.fd, reinterpret_cast<uint8_t*>(&x.inSize) + x.received, PREFIX - x.received, MSG_DONTWAIT);
+					if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+					if (n <= 0) return LinkError("receive", error);
+					x.received += n;
+					if (x.received == PREFIX) x.in->resize(x.inSize);
+				}
+				else if (x.received < PREFIX + x.inSize)
+				{
+					errno = 0;
+					ssize_t n = recv(x.fd, x.in->data() + (x.received - PREFIX), PREFIX + x.inSize - x.received, MSG_DONTWAIT);
+					if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+					if (n <= 0) return LinkError("receive", error);
+					x.received += n;
+				}
+			}
+		}
+	}
+}
+
+// Swaps one message with each neighbor that exists
+static bool ExchangeNeighbors(const Slab& slab, const vector<uint8_t>& toLeft, const vector<uint8_t>& toRight,
+	vector<uint8_t>& fromLeft, vector<uint8_t>& fromRight, string& error)
+{
+	Transfer transfers[2];
+	int count = 0;
+	if (slab.leftLink >= 0) transfers[count++] = Transfer{ slab.leftLink, &toLeft, &fromLeft, 0, 0, 0, 0 };
+	if (slab.rightLink >= 0) transfers[count++] = Transfer{ slab.rightLink, &toRight, &fromRight, 0, 0, 0, 0 };
+
+	fromLeft.clear();
+	fromRight.clear();
+	return Exchange(transfers, count, error);
+}
+
+vector<double> SlabBorders(const Simulation& sim, unsigned ranks)
+{
+	vector<double> xs;
+	for (const Particle& p : sim.particles)
+		if (!p.isBoundary) xs.push_back(p.x(0));
+	sort(xs.begin(), xs.end());
+
+	const double MIN_WIDTH = MIN_SLAB_SUPPORTS * sim.kernel.support;
+	vector<double> borders;
+	for (unsigned r = 1; r < ranks; r++)
+	{
+		double border = xs.empty() ? 0.0 : xs[xs.size() * r / ranks];
+		if (!borders.empty()) border = max(border, borders.back() + MIN_WIDTH);
+		borders.push_back(border);
+	}
+	return borders;
+}
+
+void KeepSlab(Simulation& sim, const Slab& slab)
+{
+	for (size_t i = 0; i < sim.particles.size(); i++)
+	{
+		double x = sim.particles[i].x(0);
+		if (x < slab.left || x >= slab.right) RemoveParticle(sim, i);
+	}
+	CompactParticles(sim);
+}
+
+// Moves the borders of the slab toward the busier neighbor. The busier rank of a
+// pair picks the new border among its own particles and sends it, the
+// other takes it.
+static bool Rebalance(Simulation& sim, Slab& slab, string& error)
+{
+	const size_t owned = OwnedCount(sim);
+	const double MIN_WIDTH = MIN_SLAB_SUPPORTS * sim.kernel.support;
+
+	vector<double> xs;
+	for (size_t i = 0; i < owned; i++)
+		if (!sim.particles[i].isBoundary) xs.push_back(sim.particles[i].x(0));
+	sort(xs.begin(), xs.end());
+
+	const double myLoad = slab.load;
+	vector<uint8_t> mine, fromLeft, fromRight;
+	Append(mine, myLoad);
+	if (!ExchangeNeighbors(slab, mine, mine, fromLeft, fromRight, error)) return false;
+	slab.load = 0.0;
+
+	// particles to give up to a neighbor with the given load, 0 when that
+	// one is busier
+	auto share = [&](const vector<uint8_t>& theirs) -> size_t
+	{
+		if (theirs.size() != sizeof(double) || xs.empty()) return 0;
+
+		double theirLoad = Read<double>(theirs, 0);
+		if (myLoad - theirLoad <= REBALANCE_TOLERANCE * (myLoad + theirLoad)) return 0;
+
+		double perParticle = myLoad / xs.size();
+		double count = REBALANCE_DAMPING * 0.5 * (myLoad - theirLoad) / perParticle;
+		return min(static_cast<size_t>(count), xs.size() / 2);
+	};
+
+	const double NO_PROPOSAL = numeric_limits<double>::quiet_NaN();
+	double left = slab.left, right = slab.right;
+	double proposeLeft = NO_PROPOSAL, proposeRight = NO_PROPOSAL;
+
+	size_t giveLeft = slab.leftLink >= 0 ? share(fromLeft) : 0;
+	if (giveLeft > 0)
+	{
+		proposeLeft = min(xs[giveLeft], right - MIN_WIDTH);
+		if (proposeLeft <= left) proposeLeft = NO_PROPOSAL;
+		else left = proposeLeft;
+	}
+
+	size_t giveRight = slab.rightLink >= 0 ? share(fromRight) : 0;
+	if (giveRight > 0)
+	{
+		proposeRight = max(xs[xs.size() - giveRight], left + MIN_WIDTH);
+		if (proposeRight >= right) proposeRight = NO_PROPOSAL;
+	}
+
+	vector<uint8_t> toLeft, toRight;
+	Append(toLeft, proposeLeft);
+	Append(toRight, proposeRight);
+	if (!ExchangeNeighbors(slab, toLeft, toRight, fromLeft, fromRight, error)) return false;
+
+	// at most one side of a border proposes
+	double leftProposal = !std::isnan(proposeLeft) ? proposeLeft : fromLeft.size() == sizeof(double) ? Read<double>(fromLeft, 0) : NO_PROPOSAL;
+	double rightProposal = !std::isnan(proposeRight) ? proposeRight : fromRight.size() == sizeof(double) ? Read<double>(fromRight, 0) : NO_PROPOSAL;
+	if (!std::isnan(leftProposal)) { slab.left = leftProposal; slab.rebalances++; }
+	if (!std::isnan(rightProposal)) { slab.right = rightProposal; slab.rebalances++; }
+	return true;
+}
+
+// Hands the particles outside the slab to the neighbors and takes theirs
+static bool Migrate(Simulation& sim, Slab& slab, string& error)
+{
+	vector<uint8_t> toLeft, toRight, fromLeft, fromRight;
+
+	for (size_t i = 0; i < sim.particles.size(); i++)
+	{
+		const Particle& p = sim.particles[i];
+		vector<uint8_t>* out = p.x(0) < slab.left && slab.leftLink >= 0 ? &toLeft :
+			p.x(0) >= slab.right && slab.rightLink >= 0 ? &toRight : nullptr;
+		if (!out) continue;
+
+		Append(*out, ToWire(p));
+		RemoveParticle(sim, i);
+		slab.migrated++;
+	}
+	CompactParticles(sim);
+
+	if (!ExchangeNeighbors(slab, toLeft, toRight, fromLeft, fromRight, error)) return false;
+	UnpackParticles(fromLeft, 0, sim);
+	UnpackParticles(fromRight, 0, sim);
+	return true;
+}
+
+// Copies the particles near the borders to the neighbors and appends theirs
+static bool SendHalos(Simulation& sim, Slab& slab, string& error)
+{
+	const float SUPPORT = sim.kernel.support;
+	vector<uint8_t> toLeft, toRight, fromLeft, fromRight;
+
+	slab.haloLeft.clear();
+	slab.haloRight.clear();
+	for (size_t i = 0; i < sim.particles.size(); i++)
+	{
+		const Particle& p = sim.particles[i];
+		if (slab.leftLink >= 0 && p.x(0) < slab.left + SUPPORT)
+		{
+			slab.haloLeft.push_back(static_cast<uint32_t>(i));
+			Append(toLeft, ToWire(p));
+		}
+		if (slab.rightLink >= 0 && p.x(0) >= slab.right - SUPPORT)
+		{
+			slab.haloRight.push_back(static_cast<uint32_t>(i));
+			Append(toRight, ToWire(p));
+		}
+	}
+
+	if (!ExchangeNeighbors(slab, toLeft, toRight, fromLeft, fromRight, error)) return false;
+
+	size_t owned = sim.particles.size();
+	UnpackParticles(fromLeft, 0, sim);
+	slab.haloFromLeft = sim.particles.size() - owned;
+	UnpackParticles(fromRight, 0, sim);
+	sim.haloCount = sim.particles.size() - owned;
+	return true;
+}
+
+// Sends the fresh densities and pressures of the particles copied by
+// SendHalos, in the same order, and updates the halos from theirs
+static bool RefreshHalos(Simulation& sim, Slab& slab, string& error)
+{
+	vector<uint8_t> toLeft, toRight, fromLeft, fromRight;
+	for (uint32_t i : slab.haloLeft) Append(toLeft, WireState{ sim.particles[i].rho, sim.particles[i].p });
+	for (uint32_t i : slab.haloRight) Append(toRight, WireState{ sim.particles[i].rho, sim.particles[i].p });
+
+	if (!ExchangeNeighbors(slab, toLeft, toRight, fromLeft, fromRight, error)) return false;
+
+	const size_t first = OwnedCount(sim);
+	const size_t fromRightCount = sim.haloCount - slab.haloFromLeft;
+	if (fromLeft.size() != slab.haloFromLeft * sizeof(WireState) || fromRight.size() != fromRightCount * sizeof(WireState))
+	{
+		error = "halo refresh does not match the halos sent";
+		return false;
+	}
+
+	for (size_t k = 0; k < sim.haloCount; k++)
+	{
+		WireState state = k < slab.haloFromLeft ? Read<WireState>(fromLeft, k) : Read<WireState>(fromRight, k - slab.haloFromLeft);
+		Particle& p = sim.particles[first + k];
+		p.rho = state.rho;
+		p.p = state.p;
+	}
+	return true;
+}
+
+void DropHalos(Simulation& sim)
+{
+	sim.particles.erase(sim.particles.begin() + OwnedCount(sim), sim.particles.end());
+	sim.haloCount = 0;
+}
+
+bool StepSlab(Simulation& sim, Slab& slab, string& error)
+{
+	ArenaScope scratch(sim.scratch);
+
+	// last step's halos go first, so only owned particles migrate
+	DropHalos(sim);
+
+	if (slab.rebalanceEvery && sim.stepCount > 0 && sim.stepCount % slab.rebalanceEvery == 0 && !Rebalance(sim, slab, error)) return false;
+	if (!Migrate(sim, slab, error)) return false;
+	if (!SendHalos(sim, slab, error)) return false;
+
+	double start = CpuSeconds();
+	NeighborSearch(sim);
+	UpdateSleep(sim);
+	CalculateDensityPressure(sim);
+	slab.load += CpuSeconds() - start;
+
+	if (!RefreshHalos(sim, slab, error)) return false;
+
+	start = CpuSeconds();
+	CalculateForces(sim);
+	UpdatePositionVelocity(sim);
+	slab.load += CpuSeconds() - start;
+
+	sim.stepCount++;
+	sim.simTime += sim.dt;
+	return true;
+}
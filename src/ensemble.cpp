@@ -0,0 +1,277 @@
+#include "ensemble.hpp"
+#include "profiler.hpp"
+#include "scene.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace Eigen;
+
+bool SetupEnsemble(Ensemble& ensemble, const Scene& scene, size_t members, string& error)
+{
+	// periodic members would need wrapped offsets, and without walls one
+	// escaping particle would stretch every tile
+	if (!scene.params.walls || scene.params.periodicX || scene.params.periodicY)
+	{
+		error = "ensembles need a scene with walls and no periodic axes";
+		return false;
+	}
+
+	ensemble.params = scene.params;
+	ensemble.kernel = Kernel(scene.params.h);
+	ensemble.dt = scene.params.dt;
+	ensemble.stepCount = 0;
+	ensemble.simTime = 0.0;
+
+	ensemble.obstacles.polygons = scene.obstacles;
+	ensemble.obstacles.rebuild();
+
+	ensemble.x.clear(); ensemble.y.clear();
+	ensemble.vx.clear(); ensemble.vy.clear();
+	ensemble.fx.clear(); ensemble.fy.clear();
+	ensemble.rho.clear(); ensemble.p.clear();
+	ensemble.boundary.clear();
+	ensemble.member.clear();
+	ensemble.memberStart.assign(1, 0);
+
+	Simulation layout;
+	SetParams(layout, scene.params);
+
+	for (size_t m = 0; m < members; m++)
+	{
+		layout.particles.clear();
+		layout.params.seed = scene.params.seed + m;
+		layout.rng = Rng(layout.params.seed);
+		InitParticles(layout, scene.fluid, scene.boundary);
+
+		for (const Particle& pi : layout.particles)
+		{
+			ensemble.x.push_back(pi.x(0));
+			ensemble.y.push_back(pi.x(1));
+			ensemble.vx.push_back(pi.v(0));
+			ensemble.vy.push_back(pi.v(1));
+			ensemble.fx.push_back(pi.f(0));
+			ensemble.fy.push_back(pi.f(1));
+			ensemble.rho.push_back(pi.rho);
+			ensemble.p.push_back(pi.p);
+			ensemble.boundary.push_back(pi.isBoundary);
+			ensemble.member.push_back(static_cast<uint32_t>(m));
+		}
+		ensemble.memberStart.push_back(ensemble.x.size());
+	}
+
+	// placed by every neighbor search
+	ensemble.tileX.assign(members, 0.0);
+	ensemble.tileY.assign(members, 0.0);
+	ensemble.tileWidth.assign(members, 0.0);
+	ensemble.tileHeight.assign(members, 0.0);
+	return true;
+}
+
+// Lays the members out on the grid in a square of equal tiles the size of
+// the largest current bounding box, two cells apart. Points two cells apart
+// never share a 3x3 block, so no block spans two members, and the grid
+// only covers where the particles are rather than whole domains.
+static void PlaceTiles(Ensemble& e)
+{
+	const size_t members = e.memberCount();
+
+	ParallelFor(e.pool, members, "ensemble bounds", [&](size_t begin, size_t end)
+	{
+		for (size_t m = begin; m < end; m++)
+		{
+			size_t first = e.memberStart[m], last = e.memberStart[m + 1];
+			double minX = first < last ? e.x[first] : 0.0, maxX = minX;
+			double minY = first < last ? e.y[first] : 0.0, maxY = minY;
+			for (size_t i = first; i < last; i++)
+			{
+				minX = min(minX, e.x[i]); maxX = max(maxX, e.x[i]);
+				minY = min(minY, e.y[i]); maxY = max(maxY, e.y[i]);
+			}
+			e.tileX[m] = -minX;
+			e.tileY[m] = -minY;
+			e.tileWidth[m] = maxX - minX;
+			e.tileHeight[m] = maxY - minY;
+		}
+	});
+
+	double width = 0.0, height = 0.0;
+	for (size_t m = 0; m < members; m++)
+	{
+		width = max(width, e.tileWidth[m]);
+		height = max(height, e.tileHeight[m]);
+	}
+
+	double cell = e.kernel.support;
+	double strideX = (ceil(width / cell) + 2) * cell;
+	double strideY = (ceil(height / cell) + 2) * cell;
+	size_t perRow = max<size_t>(1, static_cast<size_t>(ceil(sqrt(double(members)))));
+
+	for (size_t m = 0; m < members; m++)
+	{
+		e.tileX[m] += (m % perRow) * strideX;
+		e.tileY[m] += (m / perRow) * strideY;
+	}
+}
+
+static void EnsembleNeighborSearch(Ensemble& e)
+{
+	ScopedTimer timer(PHASE_NEIGHBORS);
+
+	PlaceTiles(e);
+	e.grid.build(e.size(), e.kernel.support, [&e](size_t i)
+	{
+		uint32_t m = e.member[i];
+		return Vector2d(e.x[i] + e.tileX[m], e.y[i] + e.tileY[m]);
+	});
+}
+
+static void EnsembleDensityPressure(Ensemble& e)
+{
+	ScopedTimer timer(PHASE_DENSITY);
+
+	const Kernel kernel = e.kernel;
+	const float SUPPORT = kernel.support;
+	const float MASS = e.params.mass;
+	const float REST_DENS = e.params.restDens;
+	const float STIFFNESS = e.params.stiffness;
+	const EquationOfState EOS = e.params.eos;
+	const NeighborGrid& grid = e.grid;
+
+	// same boundary pressure rule as CalculateDensityPressure
+	ParallelFor(e.pool, e.size(), "boundary pressure", [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			if (!e.boundary[i]) continue;
+
+			Vector2d xi(e.x[i], e.y[i]);
+			int64_t last = -1;
+			grid.forEachNeighbor(i, [&](uint32_t j)
+			{
+				if (!e.boundary[j] && (Vector2d(e.x[j], e.y[j]) - xi).norm() < SUPPORT) last = max<int64_t>(last, j);
+			});
+			if (last >= 0) e.p[i] = e.p[last];
+		}
+	});
+
+	ParallelFor(e.pool, e.size(), "density", [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			if (e.boundary[i]) continue;
+
+			Vector2d xi(e.x[i], e.y[i]);
+			DensitySum sum;
+			grid.forEachNeighbor(i, [&](uint32_t j)
+			{
+				float dist = (Vector2d(e.x[j], e.y[j]) - xi).norm();
+				if (dist < SUPPORT) sum.add(MASS * KernelFunction(kernel, dist));
+			});
+
+			float rho = sum.value();
+			e.rho[i] = rho;
+			if (EOS == EquationOfState::Tait) e.p[i] = max(STIFFNESS/7 * (pow(rho/REST_DENS, 7.f) - 1), 0.0f);
+			else e.p[i] = max(STIFFNESS*(rho/REST_DENS - 1), 0.0f);
+		}
+	});
+}
+
+static void EnsembleForces(Ensemble& e)
+{
+	ScopedTimer timer(PHASE_FORCES);
+
+	const Kernel kernel = e.kernel;
+	const float H = kernel.h;
+	const float SUPPORT = kernel.support;
+	const float MASS = e.params.mass;
+	const float VISC = e.params.visc;
+	const Vector2r G = e.params.gravity.cast<Real>();
+	const NeighborGrid& grid = e.grid;
+
+	ParallelFor(e.pool, e.size(), "forces", [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			if (e.boundary[i]) continue;
+
+			Vector2d xi(e.x[i], e.y[i]);
+			Vector2r vi(e.vx[i], e.vy[i]);
+			float rhoi = e.rho[i];
+			float pi = e.p[i];
+
+			ForceSum fpress;
+			ForceSum fvisc;
+
+			grid.forEachNeighbor(i, [&](uint32_t j)
+			{
+				Vector2r rij = (Vector2d(e.x[j], e.y[j]) - xi).cast<Real>();
+				Vector2r xij = -rij;
+				Vector2r vij = vi - Vector2r(e.vx[j], e.vy[j]);
+
+				float distance = rij.norm();
+				if (distance < SUPPORT)
+				{
+					fpress.add(Real(-MASS * (pi/pow(rhoi,2) + e.p[j]/pow(e.rho[j],2))) * KernelFirstDerivativeFunction(kernel, rij.normalized(), distance));
+					fvisc.add(Real(MASS / e.rho[j] * ( vij.dot(xij) / (xij.dot(xij)+0.01f*H*H) )) * KernelFirstDerivativeFunction(kernel, rij.normalized(), distance));
+				}
+			});
+
+			Vector2r f = fpress.value() + 2*VISC * fvisc.value() + G;
+			e.fx[i] = f(0);
+			e.fy[i] = f(1);
+		}
+	});
+}
+
+static void EnsembleIntegration(Ensemble& e)
+{
+	ScopedTimer timer(PHASE_INTEGRATION);
+
+	const IntegrationConstants constants(e.params, e.dt);
+	const up::Obstacles& obstacles = e.obstacles;
+
+	ParallelFor(e.pool, e.size(), "integration", [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			if (e.boundary[i]) continue;
+
+			Particle pi(0.f, 0.f, e.rho[i], false);
+			pi.x = Vector2d(e.x[i], e.y[i]);
+			pi.v = Vector2r(e.vx[i], e.vy[i]);
+			pi.f = Vector2r(e.fx[i], e.fy[i]);
+
+			IntegrateParticle(constants, obstacles, pi);
+
+			e.x[i] = pi.x(0); e.y[i] = pi.x(1);
+			e.vx[i] = pi.v(0); e.vy[i] = pi.v(1);
+		}
+	});
+}
+
+void StepEnsemble(Ensemble& ensemble)
+{
+	EnsembleNeighborSearch(ensemble);
+	EnsembleDensityPressure(ensemble);
+	EnsembleForces(ensemble);
+	EnsembleIntegration(ensemble);
+
+	ensemble.stepCount++;
+	ensemble.simTime += ensemble.dt;
+}
+
+void ExportMember(const Ensemble& ensemble, size_t member, vector<Particle>& particles)
+{
+	particles.clear();
+	for (size_t i = ensemble.memberStart[member]; i < ensemble.memberStart[member + 1]; i++)
+	{
+		Particle pi(0.f, 0.f, ensemble.rho[i], ensemble.boundary[i] != 0);
+		pi.x = Vector2d(ensemble.x[i], ensemble.y[i]);
+		pi.v = Vector2r(ensemble.vx[i], ensemble.vy[i]);
+		pi.f = Vector2r(ensemble.fx[i], ensemble.fy[i]);
+		pi.p = ensemble.p[i];
+		particles.push_back(pi);
+	}
+}
@@ -0,0 +1,166 @@
+#include "load_balance.hpp"
+#include "sph.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// A stretch may be off its share of the cost by this fraction before its
+// cuts move
+const static double BALANCE_TOLERANCE = 0.05;
+
+// Spreads the low 32 bits of v over the even bits
+static uint64_t SpreadBits(uint64_t v)
+{
+	v &= 0xffffffffull;
+	v = (v | v << 16) & 0x0000ffff0000ffffull;
+	v = (v | v << 8) & 0x00ff00ff00ff00ffull;
+	v = (v | v << 4) & 0x0f0f0f0f0f0f0f0full;
+	v = (v | v << 2) & 0x3333333333333333ull;
+	v = (v | v << 1) & 0x5555555555555555ull;
+	return v;
+}
+
+// Morton key of the world cell around x, so keys do not depend on the
+// bounding box of the step's grid
+static uint64_t CurveKey(double x, double y, double invCell)
+{
+	auto axis = [invCell](double v) -> uint64_t
+	{
+		double c = floor(v * invCell) + 2147483648.0;
+		return static_cast<uint64_t>(min(max(c, 0.0), 4294967295.0));
+	};
+	return SpreadBits(axis(x)) | SpreadBits(axis(y)) << 1;
+}
+
+// Cuts for the curve whose cells, in key order, have the given keys and
+// prefix costs (prefix[k] is the cost before cell k). Each cut starts at
+// its old key and moves only as far as its window around the even share;
+// without old cuts it goes as close to the share as the cells allow.
+static void Cut(const uint64_t* keys, const double* prefix, size_t count, size_t parts, vector<uint64_t>& cuts)
+{
+	const double share = prefix[count] / parts;
+	const bool fresh = cuts.size() != parts - 1;
+	if (fresh) cuts.assign(parts - 1, 0);
+
+	for (size_t j = 1; j < parts; j++)
+	{
+		uint64_t& cut = cuts[j - 1];
+		double target = j * share;
+		double low = target - BALANCE_TOLERANCE * share, high = target + BALANCE_TOLERANCE * share;
+
+		// k is the first cell after the cut
+		size_t k = fresh ? 0 : lower_bound(keys, keys + count, cut) - keys;
+		if (fresh || prefix[k] < low || prefix[k] > high)
+		{
+			double goal = fresh ? target : min(max(prefix[k], low), high);
+			size_t next = upper_bound(prefix, prefix + count + 1, goal) - prefix;	// first prefix above goal
+			size_t below = next > 0 ? next - 1 : 0;
+			k = next <= count && prefix[next] - goal < goal - prefix[below] ? next : below;
+			cut = k < count ? keys[k] : ~0ull;
+		}
+
+		if (j > 1) cut = max(cut, cuts[j - 2]);
+	}
+}
+
+static size_t PartOf(const vector<uint64_t>& cuts, uint64_t key)
+{
+	return upper_bound(cuts.begin(), cuts.end(), key) - cuts.begin();
+}
+
+// Cuts the curve by cost(c) of each cell, in scratch memory of sim
+template<class Cost>
+static void CutByCost(Simulation& sim, Cost cost)
+{
+	CellPartition& partition = sim.partition;
+	const size_t count = partition.cellKey.size();
+
+	uint32_t* order = sim.scratch.allocate<uint32_t>(count);
+	for (size_t c = 0; c < count; c++) order[c] = static_cast<uint32_t>(c);
+	sort(order, order + count, [&](uint32_t a, uint32_t b) { return partition.cellKey[a] < partition.cellKey[b]; });
+
+	// keys in curve order, prefix[k] the cost before the k-th cell
+	uint64_t* keys = sim.scratch.allocate<uint64_t>(count);
+	double* prefix = sim.scratch.allocate<double>(count + 1);
+	prefix[0] = 0.0;
+	for (size_t k = 0; k < count; k++)
+	{
+		keys[k] = partition.cellKey[order[k]];
+		prefix[k + 1] = prefix[k] + cost(order[k]);
+	}
+
+	if (prefix[count] > 0.0) Cut(keys, prefix, count, partition.parts(), partition.cuts);
+}
+
+void AssignCells(Simulation& sim)
+{
+	CellPartition& partition = sim.partition;
+	const size_t parts = sim.pool ? sim.pool->size() : 1;
+	const NeighborGrid& grid = sim.grid;
+	const size_t cellCount = grid.cellCount();
+
+	if (sim.params.balanceEvery == 0 || parts < 2)
+	{
+		partition.partStart.clear();
+		partition.measuring = false;
+		return;
+	}
+
+	ArenaScope scratch(sim.scratch);
+	const vector<uint32_t>& cellStart = grid.cellStart();
+	const vector<uint32_t>& sorted = grid.sorted();
+	const double invCell = 1.0 / grid.cellSize();
+
+	// every stored cell holds a particle; its first one places it
+	partition.cellKey.resize(cellCount);
+	for (size_t c = 0; c < cellCount; c++)
+	{
+		if (cellStart[c] == cellStart[c + 1]) partition.cellKey[c] = 0;
+		else
+		{
+			const Particle& p = sim.particles[sorted[cellStart[c]]];
+			partition.cellKey[c] = CurveKey(p.x(0), p.x(1), invCell);
+		}
+	}
+
+	partition.partStart.assign(parts + 1, 0);
+	if (partition.cuts.size() != parts - 1)
+	{
+		partition.cuts.clear();
+		CutByCost(sim, [&](uint32_t c) { return double(cellStart[c + 1] - cellStart[c]); });
+		partition.cuts.resize(parts - 1, ~0ull);
+	}
+
+	// stable counting sort of the cells by part
+	for (size_t c = 0; c < cellCount; c++) partition.partStart[PartOf(partition.cuts, partition.cellKey[c]) + 1]++;
+	for (size_t p = 1; p <= parts; p++) partition.partStart[p] += partition.partStart[p - 1];
+
+	uint32_t* cursor = sim.scratch.allocate<uint32_t>(parts);
+	copy(partition.partStart.begin(), partition.partStart.end() - 1, cursor);
+	partition.cells.resize(cellCount);
+	for (size_t c = 0; c < cellCount; c++) partition.cells[cursor[PartOf(partition.cuts, partition.cellKey[c])]++] = static_cast<uint32_t>(c);
+
+	partition.measuring = sim.stepCount % sim.params.balanceEvery == 0;
+	if (partition.measuring)
+	{
+		GrowCapacity(partition.cellCost, cellCount);
+		partition.cellCost.assign(cellCount, 0.f);
+	}
+}
+
+void RebalanceCells(Simulation& sim)
+{
+	CellPartition& partition = sim.partition;
+	if (partition.parts() == 0 || !partition.measuring) return;
+	partition.measuring = false;
+
+	ArenaScope scratch(sim.scratch);
+	partition.previousCuts = partition.cuts;
+	CutByCost(sim, [&](uint32_t c) { return double(partition.cellCost[c]); });
+	if (partition.cuts == partition.previousCuts) return;
+
+	partition.recuts++;
+	for (uint64_t key : partition.cellKey) partition.movedCells += PartOf(partition.previousCuts, key) != PartOf(partition.cuts, key);
+}
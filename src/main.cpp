@@ -1,14 +1,24 @@
 #include <SFML/Graphics.hpp>
 #include <sstream>
 #include <stdlib.h>
+#include <csignal>
 
 #include "utils.hpp"
+#include "snapshot.hpp"
+#include "output_pipeline.hpp"
+#include "text_writer.hpp"
+#include "checkpoint.hpp"
+#include "sph.hpp"
+#include "profiler.hpp"
+#include "scene.hpp"
+#include "thread_pool.hpp"
 
 #include <iostream>
 #include <fstream>
 
 #include <string>
 #include <algorithm>
+#include <memory>
 #include <vector>
 using namespace std;
 
@@ -17,105 +27,55 @@ using namespace Eigen;
 
 static sf::Texture m_bodyTexture; 
 static sf::VertexArray m_va(sf::Quads, 0);
+static sf::VertexArray m_obstacleVa(sf::Lines, 0);
+static sf::Font m_font;
 
 std::ofstream simulationFile;
+static TextWriter simulationCsv(simulationFile);
+static SnapshotWriter snapshotFile;
+static OutputPipeline outputPipeline;
 
-//Particle config
-const static int INIT_PARTICLES = 100;
+//Particle rendering
 const static int PARTICLE_RADIUS_VIZ = 8;
-const static int BOUNDARY_PARTICLES = 63;
-
-const static Vector2d G(0.f, -9.8f); // gravity forces
-
-const static float H = 16.f;				// Kernel support 
-const static float EPS = H; 				// Boundary epsilon
-const static float MASS = 45.f;			
-const static float VISC = 5.f;			// 5
-
-const static float REST_DENS = 0.176f;		 // rest density 0.1f
-const static float STIFFNESS = 2.f;		 // const for equation of state 2
-
-static float DT = 0.01f;			 // integration timestep
-
-const static float BOUND_DAMPING = -0.5f;
-
-// rendering projection parameters
-const static double VIEW_WIDTH = 800.f;
-const static double VIEW_HEIGHT = 600.f;
 
 bool update = false;
 bool logInfo = false;
-int counter = 0;
+bool logFrames = false;
+bool showProfile = false;
 
-struct Particle
-{
-	Particle(float _x, float _y, bool _isBoundary) : x(_x, _y), v(0.f, 0.f), f(0.f, 0.f), rho(REST_DENS), p(0.f), isBoundary(_isBoundary) {}
-	Vector2d  x, v, f;
-	float rho, p;
-	vector<Particle> neighbors;
-	bool isBoundary;
-};
+//Checkpointing, the cadence comes from the scene
+static std::string checkpointPath = "checkpoint.fsck";
+static std::string tracePath;
+static volatile std::sig_atomic_t preempted = 0;
 
-//Particles list
-static vector<Particle> particles;
+static Scene scene;
+static Simulation sim;
+static std::unique_ptr<ThreadPool> pool;
 
-void InitParticles(void)
-{
-	for (float y = EPS; y < VIEW_HEIGHT - EPS * 2.f; y += H)
-		for (float x = VIEW_WIDTH / 4; x <= VIEW_WIDTH / 2; x += H)
-			if (particles.size() < INIT_PARTICLES)
-			{
-				float jitter = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-				particles.push_back(Particle(x + jitter, y + 300, false));
-			}
+// Quad corners around a particle centre, in units of its radius, and the
+// matching corners of the particle texture
+static const up::Vec2 QUAD_CORNERS[4] = { up::Vec2(-1.f, -1.f), up::Vec2(1.f, -1.f), up::Vec2(1.f, 1.f), up::Vec2(-1.f, 1.f) };
+static const up::Vec2 QUAD_TEX_CORNERS[4] = { up::Vec2(0.f, 0.f), up::Vec2(512.f, 0.f), up::Vec2(512.f, 512.f), up::Vec2(0.f, 512.f) };
 
-	
-	for(float y = EPS; y < VIEW_HEIGHT - EPS * 2.f; y += H){
-		for (float x = VIEW_WIDTH / 4; x <= VIEW_WIDTH / 1.5f ; x += H)
-			if (particles.size() < INIT_PARTICLES + BOUNDARY_PARTICLES)
-			{
-				particles.push_back(Particle(x - 100, y + 500, true));
-			}
-	}
+static sf::Vector2f ToSf(const up::Vec2& v)
+{
+	return sf::Vector2f(v.x, v.y);
 }
 
-void UpdatePositionVelocity(void)
+void BuildObstacleMesh(void)
 {
-    for(auto &p : particles)
-    {
-		if(p.isBoundary) continue;
-
-        // explicit Euler integration
-        p.v += DT*-p.f;
-        p.x += DT*p.v;
-
-        // enforce boundary conditions
-        if(p.x(0)-EPS < 0.0f)
-        {
-            p.v(0) *= BOUND_DAMPING;
-            p.x(0) = EPS;
-        }
-        if(p.x(0)+EPS > VIEW_WIDTH) 
-        {
-            p.v(0) *= BOUND_DAMPING;
-            p.x(0) = VIEW_WIDTH-EPS;
-        }
-        if(p.x(1)-EPS < 0.0f)
-        {
-            p.v(1) *= BOUND_DAMPING;
-            p.x(1) = EPS;
-        }
-        if(p.x(1)+EPS > VIEW_HEIGHT)
-        {
-            p.v(1) *= BOUND_DAMPING;
-            p.x(1) = VIEW_HEIGHT-EPS;
-        }
-    }
+	m_obstacleVa.clear();
+
+	for (const up::Segment& s : sim.obstacles.bvh.segments())
+	{
+		m_obstacleVa.append(sf::Vertex(ToSf(s.p1), sf::Color(200, 200, 200)));
+		m_obstacleVa.append(sf::Vertex(ToSf(s.p2), sf::Color(200, 200, 200)));
+	}
 }
 
 void Render(sf::RenderTexture& m_target)
 {
-	sf::RectangleShape ground(sf::Vector2f(VIEW_WIDTH, VIEW_HEIGHT));
+	sf::RectangleShape ground(sf::Vector2f(sim.params.viewWidth, sim.params.viewHeight));
     ground.setFillColor(sf::Color::Black);
 
 	sf::RenderStates rs_ground;
@@ -125,160 +85,216 @@ void Render(sf::RenderTexture& m_target)
 	rs.texture = &m_bodyTexture;
 	
 	//Update vertex array
-	m_va.resize(4 * particles.size());
+	m_va.resize(4 * sim.particles.size());
 
-	for (int i = 0; i < particles.size(); i++)
+	for (int i = 0; i < sim.particles.size(); i++)
 	{
-		Particle p = particles[i];
-
-		m_va[4 * i + 0].position = sf::Vector2f(p.x(0) - PARTICLE_RADIUS_VIZ, p.x(1) - PARTICLE_RADIUS_VIZ);
-		m_va[4 * i + 1].position = sf::Vector2f(p.x(0) + PARTICLE_RADIUS_VIZ, p.x(1) - PARTICLE_RADIUS_VIZ);
-		m_va[4 * i + 2].position = sf::Vector2f(p.x(0) + PARTICLE_RADIUS_VIZ, p.x(1) + PARTICLE_RADIUS_VIZ);
-		m_va[4 * i + 3].position = sf::Vector2f(p.x(0) - PARTICLE_RADIUS_VIZ, p.x(1) + PARTICLE_RADIUS_VIZ);
-
-		m_va[4 * i + 0].texCoords = sf::Vector2f(0, 0);
-		m_va[4 * i + 1].texCoords = sf::Vector2f(512, 0);
-		m_va[4 * i + 2].texCoords = sf::Vector2f(512, 512);
-		m_va[4 * i + 3].texCoords = sf::Vector2f(0, 512);
+		const Particle& p = sim.particles[i];
+		float radius = PARTICLE_RADIUS_VIZ * sim.levelH[p.level] / sim.params.h;
+		up::Vec2 centre(p.x(0), p.x(1));
 
 		sf::Color color = sf::Color(0, 100, 255);
 		if(p.isBoundary) color = sf::Color(255, 0, 0);
 
-		m_va[4 * i + 0].color = color;
-		m_va[4 * i + 1].color = color;
-		m_va[4 * i + 2].color = color;
-		m_va[4 * i + 3].color = color;
+		for (int k = 0; k < 4; k++)
+		{
+			m_va[4 * i + k].position = ToSf(centre + radius * QUAD_CORNERS[k]);
+			m_va[4 * i + k].texCoords = ToSf(QUAD_TEX_CORNERS[k]);
+			m_va[4 * i + k].color = color;
+		}
 	}
 
     m_target.draw(m_va, rs);	
+	m_target.draw(m_obstacleVa);
 }
 
-void NeighborSearch()
+// Copies the state to be logged into a pooled buffer and queues it for the
+// writer thread, so the step never waits on formatting or the disk
+void OutputInfo(void)
 {
-	for (int i = 0; i < particles.size(); i++)
-	{
-		Particle p = particles[i];
-		p.neighbors.clear();
+	ScopedTimer timer(PHASE_OUTPUT);
 
-		for (int j = 0; j < particles.size(); j++)
-		{
-			Particle n = particles[j];
-			Vector2d neighborDistance = p.x - n.x;
-			float distance = neighborDistance.norm();
+	OutputFrame* frame = outputPipeline.acquire();
+	if(!frame) return;
 
-			if(distance < 2*H) {
-				p.neighbors.push_back(Particle(n.x(0), n.x(1), n.isBoundary));
-			}
-		}
-	}
+	frame->targets = (logInfo ? OUTPUT_CSV : 0) | (logFrames ? OUTPUT_SNAPSHOT : 0);
 
-	std::cout << "Particle 14 neighbors size:" << to_string(particles[14].neighbors.size()) << std::endl;
+	SnapshotFrame& data = frame->data;
+	data.step = sim.stepCount;
+	data.time = sim.simTime;
+	data.resize(logFrames ? sim.particles.size() : 1);
 
-	for(int i = 0; i<particles[14].neighbors.size(); i++){
-		Particle n = particles[14].neighbors[i];
-		std::cout << to_string(i) << ":" << to_string(n.x(0)) << std::endl;
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		const Particle& pi = sim.particles[i];
+		data.x[i] = pi.x(0);
+		data.y[i] = pi.x(1);
+		data.vx[i] = pi.v(0);
+		data.vy[i] = pi.v(1);
+		data.rho[i] = pi.rho;
+		data.p[i] = pi.p;
+		data.flags[i] = pi.isBoundary ? SNAP_FLAG_BOUNDARY : 0;
 	}
+
+	outputPipeline.submit(frame);
 }
 
-float KernelFunction(float distance)
+// Runs on the output writer thread
+void WriteOutput(const OutputFrame& frame)
 {
-	float q = distance/H;
-	float alpha = 5/(14*M_PI*pow(H, 2));
-	float t1 = max(1-q, 0.f);
-	float t2 = max(2-q, 0.f);
-
-	if(0 <= q && q < 1) {
-		return alpha * (t2*t2*t2 - 4*t1*t1*t1);
-	} else if(1 <= q && q < 2){
-		return alpha * t2*t2*t2;
+	const SnapshotFrame& data = frame.data;
+
+	if(frame.targets & OUTPUT_CSV)
+	{
+		// ostream's default of 6 significant digits, as the file always had
+		const int DIGITS = 6;
+		simulationCsv << data.step << ',' << Significant(data.x[0], DIGITS) << ',' << Significant(-data.y[0], DIGITS) << ','
+			<< Significant(data.rho[0], DIGITS) << ',' << Significant(data.p[0], DIGITS) << '\n';
 	}
-	else return 0;
+
+	if(frame.targets & OUTPUT_SNAPSHOT) snapshotFile.write(data);
 }
 
-Vector2d KernelFirstDerivativeFunction(Vector2d normalizedDistance, float distance)
+bool SaveState(const std::string& path)
 {
-	float q = distance/H;
-	Vector2d derivQ = normalizedDistance*H;
-	float alpha = 5/(14*M_PI*pow(H, 2));
-	float t1 = max(1-q, 0.f);
-	float t2 = max(2-q, 0.f);
-
-	if(0 <= q && q < 1) {
-		return alpha * derivQ * (-3 * t2 * t2 - 12 * t1 * t1);
-	} else if(1 <= q && q < 2){
-		return alpha * derivQ * -3 * t2 * t2;
+	CheckpointHeader header = {};
+	header.stepCount = sim.stepCount;
+	header.simTime = sim.simTime;
+	header.dt = sim.dt;
+	header.rngState = sim.rng.state;
+	header.h = sim.kernel.h;
+	header.support = sim.kernel.support;
+	header.viewWidth = sim.params.viewWidth;
+	header.viewHeight = sim.params.viewHeight;
+
+	vector<CheckpointParticle> records(sim.particles.size());
+	for (size_t i = 0; i < sim.particles.size(); i++)
+	{
+		const Particle& pi = sim.particles[i];
+		CheckpointParticle& r = records[i];
+		r.x[0] = pi.x(0); r.x[1] = pi.x(1);
+		r.v[0] = pi.v(0); r.v[1] = pi.v(1);
+		r.f[0] = pi.f(0); r.f[1] = pi.f(1);
+		r.rho = pi.rho;
+		r.p = pi.p;
+		r.flags = (pi.isBoundary ? CHECKPOINT_BOUNDARY : 0) | uint32_t(pi.level) << CHECKPOINT_LEVEL_SHIFT;
+		r.quietSteps = pi.quietSteps;
+	}
+
+	vector<CheckpointEmitter> emitters(sim.emitters.size());
+	for (size_t e = 0; e < sim.emitters.size(); e++)
+	{
+		emitters[e].emitted = sim.emitters[e].emitted;
+		emitters[e].cursor = sim.emitters[e].cursor;
+		emitters[e].pending = sim.emitters[e].pending;
+	}
+
+	std::string error;
+	if(!SaveCheckpoint(path, header, records, emitters, error)) {
+		std::cout << "Checkpoint failed: " << error << std::endl;
+		return false;
 	}
-	else return Vector2d(0.f,0.f);
+
+	std::cout << "Checkpoint saved at step " << sim.stepCount << " to " << path << std::endl;
+	return true;
 }
 
-void CalculateDensityPressure(void)
+bool RestoreState(const std::string& path)
 {
-	for(auto &pi : particles)
-    {
-		if(pi.isBoundary) continue;
-		
-		pi.rho = 0.f;
-		for(auto &pj : particles)
-		{
-			Vector2d rij = pj.x - pi.x;
-			float dist = rij.norm();
+	CheckpointReader reader;
+	std::string error;
+	if(!reader.open(path, error)) {
+		std::cout << "Restore failed: " << error << std::endl;
+		return false;
+	}
 
-			if(dist < 2*H) pi.rho += MASS * KernelFunction(dist);
-			if(pj.isBoundary && dist < 2*H) pj.p = pi.p;
-		}
-		
-		pi.p = max(STIFFNESS*(pi.rho/REST_DENS - 1), 0.0f);
-    }
+	const CheckpointHeader& header = reader.header();
+	if(header.h != sim.kernel.h || header.support != sim.kernel.support || header.viewWidth != sim.params.viewWidth || header.viewHeight != sim.params.viewHeight) {
+		std::cout << "Restore failed: " << path << " was written with H=" << header.h << " and a "
+			<< header.viewWidth << "x" << header.viewHeight << " domain" << std::endl;
+		return false;
+	}
+	if(header.emitterCount != sim.emitters.size()) {
+		std::cout << "Restore failed: " << path << " was written with " << header.emitterCount << " emitters, the scene has "
+			<< sim.emitters.size() << std::endl;
+		return false;
+	}
+
+	sim.particles.clear();
+	sim.freeSlots.clear();
+	sim.particles.reserve(header.particleCount);
+
+	const CheckpointParticle* records = reader.particles();
+	for (uint64_t i = 0; i < header.particleCount; i++)
+	{
+		const CheckpointParticle& r = records[i];
+		Particle pi(r.x[0], r.x[1], r.rho, (r.flags & CHECKPOINT_BOUNDARY) != 0);
+		pi.x = Vector2d(r.x[0], r.x[1]);
+		pi.v = Vector2r(r.v[0], r.v[1]);
+		pi.f = Vector2r(r.f[0], r.f[1]);
+		pi.rho = r.rho;
+		pi.p = r.p;
+		pi.level = min<uint32_t>(r.flags >> CHECKPOINT_LEVEL_SHIFT & 0xff, sim.levelMass.size() - 1);
+		pi.quietSteps = static_cast<uint16_t>(min<uint32_t>(r.quietSteps, UINT16_MAX));
+		sim.particles.push_back(pi);
+	}
+
+	sim.stepCount = header.stepCount;
+	sim.simTime = header.simTime;
+	sim.dt = header.dt;
+	sim.rng.state = header.rngState;
+
+	const CheckpointEmitter* emitters = reader.emitters();
+	for (size_t e = 0; e < sim.emitters.size(); e++)
+	{
+		sim.emitters[e].emitted = emitters[e].emitted;
+		sim.emitters[e].cursor = emitters[e].cursor;
+		sim.emitters[e].pending = emitters[e].pending;
+	}
+
+	if(NumaEnabled(scene.firstTouch)) PlaceParticles(sim);
+
+	std::cout << "Restored step " << sim.stepCount << " from " << path << std::endl;
+	return true;
 }
 
-void CalculateForces(void)
+void OnPreempt(int)
 {
-    for(auto &pi : particles)
-    {
-		if(pi.isBoundary) continue;
-
-        Vector2d fpress(0.f, 0.f);
-        Vector2d fvisc(0.f, 0.f);
-
-        for(auto &pj : particles)
-        {
-        	Vector2d rij = pj.x - pi.x;
-
-			Vector2d xij = pi.x - pj.x;
-			Vector2d vij = pi.v - pj.v;
-            
-			float distance = rij.norm();
-
-            if(distance < 2*H)
-            {
-                // compute pressure force contribution
-                fpress += -MASS * (pi.p/pow(pi.rho,2) + pj.p/pow(pj.rho,2)) * KernelFirstDerivativeFunction(rij.normalized(), distance);
-
-                // compute viscosity force contribution (non-pressure acceleration)
-                fvisc += MASS / pj.rho * ( vij.dot(xij) / (xij.dot(xij)+0.01f*H*H) ) * KernelFirstDerivativeFunction(rij.normalized(), distance);
-            }
-        }
-
-		//Sum non-pressure accelerations and pressure accelerations
-        pi.f = fpress + 2*VISC * fvisc + G;
-    }
+	preempted = 1;
 }
 
-void OutputInfo(void)
+// Rolling min/avg/p99 of every phase plus the frame time, top left
+void RenderProfile(sf::RenderTarget& target, float frameMs)
 {
-	Particle pi = particles[0];
+	std::ostringstream text;
+	text.setf(std::ios::fixed);
+	text.precision(2);
+	text << "frame " << frameMs << " ms\n";
+	if (sim.params.sleepSpeed > 0.f) text << "asleep " << sim.sleepingCount << " of " << sim.particles.size() << "\n";
 
-	simulationFile << counter << "," << pi.x(0) << "," <<  -pi.x(1) << "," << pi.rho << "," << pi.p << "\n";
-	counter++;
+	for (int i = 0; i < PHASE_COUNT; i++)
+	{
+		PhaseStats stats = GetPhaseStats(static_cast<ProfilePhase>(i));
+		text << PhaseName(static_cast<ProfilePhase>(i));
+		if (stats.samples == 0) text << "  -\n";
+		else text << "  min " << stats.minMs << "  avg " << stats.avgMs << "  p99 " << stats.p99Ms << "\n";
+	}
+
+	sf::Text overlay(text.str(), m_font, 14);
+	overlay.setFillColor(sf::Color::White);
+	overlay.setOutlineColor(sf::Color::Black);
+	overlay.setOutlineThickness(1.f);
+	overlay.setPosition(8.f, 8.f);
+	target.draw(overlay);
 }
 
 void Update(void)
 {
-	//NeighborSearch();
-	CalculateDensityPressure();
-	CalculateForces();
-	UpdatePositionVelocity();
-	if(logInfo) OutputInfo();
+	TraceScope trace("step");
+
+	Step(sim);
+	if((logInfo || logFrames) && sim.stepCount % scene.outputEvery == 0) OutputInfo();
+	if(scene.checkpointEvery && sim.stepCount % scene.checkpointEvery == 0) SaveState(checkpointPath);
 }
 
 //Keyboard inputs
@@ -294,7 +310,7 @@ void ProcessEvents(sf::RenderWindow& window)
 		{
 		case sf::Event::KeyPressed:
 			if (event.key.code == sf::Keyboard::Escape) window.close();
-			else if (event.key.code == sf::Keyboard::T) std::cout << "Number of particles: " << particles.size() << std::endl;
+			else if (event.key.code == sf::Keyboard::T) std::cout << "Number of particles: " << sim.particles.size() << std::endl;
 			else if (event.key.code == sf::Keyboard::E) {
 				update = !update;
 				if(update) std::cout << "Simulation resumed" << std::endl;
@@ -308,19 +324,30 @@ void ProcessEvents(sf::RenderWindow& window)
 				logInfo = !logInfo;
 				std::cout << "Logging info:" << logInfo << std::endl;
 			}
+			else if (event.key.code == sf::Keyboard::F) {
+				if(!snapshotFile.isOpen() && !snapshotFile.open("simOutput.fsnap")) {
+					std::cout << "Cannot open simOutput.fsnap" << std::endl;
+					break;
+				}
+				logFrames = !logFrames;
+				std::cout << "Logging frames:" << logFrames << std::endl;
+			}
 			else if (event.key.code == sf::Keyboard::M) {
-				DT *= 0.1f;
-				std::cout << "Time step: " << DT << std::endl;
+				sim.dt *= 0.1f;
+				std::cout << "Time step: " << sim.dt << std::endl;
 			}
 						else if (event.key.code == sf::Keyboard::N) {
-				DT *= 10.f;
-				std::cout << "Time step: " << DT << std::endl;
+				sim.dt *= 10.f;
+				std::cout << "Time step: " << sim.dt << std::endl;
 			}
 			else if (event.key.code == sf::Keyboard::R){
 				std::cout << "Restarting Sim" << std::endl;
-				particles.clear();
-				InitParticles();
+				SetupSimulation(sim, scene);
+				if(sim.pool && NumaEnabled(scene.firstTouch)) PlaceParticles(sim);
 			} 
+			else if (event.key.code == sf::Keyboard::C) SaveState(checkpointPath);
+			else if (event.key.code == sf::Keyboard::V) RestoreState(checkpointPath);
+			else if (event.key.code == sf::Keyboard::P) showProfile = !showProfile;
 			break;
 		default:
 			break;
@@ -328,55 +355,144 @@ void ProcessEvents(sf::RenderWindow& window)
 	}
 }
 
-int main()
+int main(int argc, char** argv)
 {
+	std::string restorePath;
+	std::string scenePath = "../res/default.scene";
+	std::vector<std::string> overrides;
+	bool perfCounters = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--restore" && i + 1 < argc) restorePath = argv[++i];
+		else if (arg == "--checkpoint" && i + 1 < argc) checkpointPath = argv[++i];
+		else if (arg == "--checkpoint-every" && i + 1 < argc) overrides.push_back(std::string("checkpoint-every=") + argv[++i]);
+		else if (arg == "--trace" && i + 1 < argc) tracePath = argv[++i];
+		else if (arg == "--perf-counters") perfCounters = true;
+		else if (arg == "--scene" && i + 1 < argc) scenePath = argv[++i];
+		else if (arg == "--set" && i + 1 < argc) overrides.push_back(argv[++i]);
+		else if (arg == "--threads" && i + 1 < argc) overrides.push_back(std::string("threads=") + argv[++i]);
+		else {
+			std::cout << "Usage: " << argv[0] << " [--scene file] [--set key=value]... [--threads n] [--restore file] [--checkpoint file] [--checkpoint-every steps] [--trace file.json] [--perf-counters]" << std::endl;
+			return 1;
+		}
+	}
+
+	// command line settings win over the scene file
+	std::string sceneError;
+	SceneLoad sceneLoad = LoadScene(scenePath, scene, sceneError);
+	if(sceneLoad == SceneLoad::Loaded) std::cout << "Loaded scene " << scenePath << std::endl;
+	else if(sceneLoad == SceneLoad::Missing) std::cout << "Using the default scene: " << sceneError << std::endl;
+	else
+	{
+		std::cout << sceneError << std::endl;
+		return 1;
+	}
+
+	for (const std::string& assignment : overrides)
+	{
+		if(!SetSceneOverride(scene, assignment, sceneError)) {
+			std::cout << sceneError << std::endl;
+			return 1;
+		}
+	}
+
+	SetupSimulation(sim, scene);
+
+	if(scene.threads > 1) {
+		pool.reset(new ThreadPool(scene.threads, NumaEnabled(scene.pinThreads)));
+		sim.pool = pool.get();
+		if(NumaEnabled(scene.firstTouch)) PlaceParticles(sim);
+	}
+
 	std::cout << "Starting Sim" << std::endl;
 
+	SetTraceThreadName("sim/render");
+	EnableTracing(!tracePath.empty());
+
+	// counters open on this thread and every pool worker, and each phase
+	// counts the work of all of them
+	std::string perfError;
+	if(perfCounters && !EnablePerfCounters(perfError, pool.get())) std::cout << "Hardware counters unavailable: " << perfError << std::endl;
+
+	// preemptible nodes get SIGTERM before being reclaimed
+	signal(SIGTERM, OnPreempt);
+
 	simulationFile.open ("simOutput.csv");
-	simulationFile << "Time, PosX, PosY, Density, Pressure \n";
+	simulationCsv << "Step, PosX, PosY, Density, Pressure \n";
+	outputPipeline.start(WriteOutput, scene.outputBuffers, scene.outputPolicy);
 
 	sf::ContextSettings settings;
 
 	settings.antialiasingLevel = 0;
 
-	sf::RenderWindow window(sf::VideoMode(VIEW_WIDTH, VIEW_HEIGHT), "Fluid Sim", sf::Style::Default, settings);
+	sf::RenderWindow window(sf::VideoMode(sim.params.viewWidth, sim.params.viewHeight), "Fluid Sim", sf::Style::Default, settings);
 	window.setVerticalSyncEnabled(true);
 	window.setFramerateLimit(60);
 
 	m_bodyTexture.loadFromFile("../res/circle.png");
+	m_font.loadFromFile("../res/font.ttf");
 
 	//Size of particle
 	const float body_radius(4.0f);
 
 	sf::RenderTexture render_tex;
-	render_tex.create(VIEW_WIDTH, VIEW_HEIGHT);
+	render_tex.create(sim.params.viewWidth, sim.params.viewHeight);
+
+	std::cout << "Loaded " << sim.obstacles.bvh.segments().size() << " obstacle segments" << std::endl;
+	BuildObstacleMesh();
 
-	InitParticles();	
+	if(!restorePath.empty()) {
+		if(RestoreState(restorePath)) update = true;
+		else return 1;
+	}
 
 	sf::Clock clock;
 	
 	while (window.isOpen())
 	{
-		clock.restart();
+		float frameMs = clock.restart().asSeconds() * 1000.f;
 
 		//Get keyboard inputs
 		ProcessEvents(window);
 
+		if(preempted) {
+			std::cout << "Terminated, saving checkpoint" << std::endl;
+			SaveState(checkpointPath);
+			window.close();
+			break;
+		}
+
 		render_tex.clear(sf::Color::White);
 		
 		//Update functions
 		if(update) Update();
 
-		//Render particles
-		Render(render_tex);
+		//Render particles, the vsync wait in display() is left out of the timing
+		{
+			ScopedTimer timer(PHASE_RENDER);
+
+			Render(render_tex);
 
-		render_tex.display();
+			render_tex.display();
 
-		window.draw(sf::Sprite(render_tex.getTexture()));
+			window.draw(sf::Sprite(render_tex.getTexture()));
+			if(showProfile) RenderProfile(window, frameMs);
+		}
 		window.display();
 	}
 
+	outputPipeline.stop();
+	std::cout << "Output frames written: " << outputPipeline.written() << ", skipped: " << outputPipeline.dropped() << std::endl;
+	DumpProfile(std::cout);
+
+	std::string traceError;
+	if(!tracePath.empty() && !WriteChromeTrace(tracePath, traceError)) std::cout << "Trace not written: " << traceError << std::endl;
+
+	simulationCsv.flush();
 	simulationFile.close();
+	snapshotFile.close();
 
 	return 0;
 }
\ No newline at end of file
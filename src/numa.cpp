@@ -0,0 +1,135 @@
+#include "numa.hpp"
+#include "sph.hpp"
+#include "thread_pool.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+// "0-3,8-11" to the listed CPUs
+static vector<int> ParseCpuList(const string& list)
+{
+	vector<int> cpus;
+	istringstream ss(list);
+	string range;
+	while (getline(ss, range, ','))
+	{
+		int first, last;
+		char dash;
+		istringstream rs(range);
+		if (!(rs >> first)) continue;
+		if (!(rs >> dash >> last) || dash != '-') last = first;
+		for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+static vector<vector<int>> ReadNodes()
+{
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	bool known = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+	auto usable = [&](int cpu) { return cpu >= 0 && cpu < CPU_SETSIZE && (!known || CPU_ISSET(cpu, &allowed)); };
+
+	vector<vector<int>> nodes;
+	for (int node = 0;; node++)
+	{
+		ifstream file("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+		if (!file.is_open()) break;
+
+		string list;
+		getline(file, list);
+
+		vector<int> cpus;
+		for (int cpu : ParseCpuList(list))
+			if (usable(cpu)) cpus.push_back(cpu);
+		if (!cpus.empty()) nodes.push_back(cpus);
+	}
+
+	if (nodes.empty())
+	{
+		vector<int> cpus;
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (known ? CPU_ISSET(cpu, &allowed) : cpu < static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN))) cpus.push_back(cpu);
+		if (cpus.empty()) cpus.push_back(0);
+		nodes.push_back(cpus);
+	}
+	return nodes;
+}
+
+const vector<vector<int>>& NumaNodes()
+{
+	static const vector<vector<int>> nodes = ReadNodes();
+	return nodes;
+}
+
+bool NumaEnabled(NumaMode mode)
+{
+	return mode == NumaMode::On || (mode == NumaMode::Auto && NumaNodes().size() > 1);
+}
+
+int PinnedCpu(unsigned index, unsigned threads)
+{
+	const vector<vector<int>>& nodes = NumaNodes();
+	size_t count = nodes.size();
+	size_t node = size_t(index) * count / threads;
+
+	// first thread of the node
+	unsigned first = index;
+	while (first > 0 && size_t(first - 1) * count / threads == node) first--;
+
+	const vector<int>& cpus = nodes[node];
+	return cpus[(index - first) % cpus.size()];
+}
+
+bool PinCurrentThread(int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+void FirstTouch(ThreadPool* pool, void* data, size_t elementSize, size_t count, size_t capacity)
+{
+	static const size_t PAGE = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	char* bytes = static_cast<char*>(data);
+
+	// the page holding the first byte of a range may belong to the range
+	// before it, whichever thread gets there first takes it
+	auto touch = [&](size_t begin, size_t end)
+	{
+		for (size_t b = begin * elementSize; b < end * elementSize; b = (b / PAGE + 1) * PAGE)
+			*static_cast<volatile char*>(bytes + b) = 0;
+	};
+
+	ParallelFor(pool, count, "first touch", touch);
+	ParallelFor(pool, capacity - count, "first touch", [&](size_t begin, size_t end) { touch(count + begin, count + end); });
+}
+
+void PlaceParticles(Simulation& sim)
+{
+	if (!sim.pool || sim.pool->size() < 2) return;
+
+	const size_t count = sim.particles.size();
+	const size_t capacity = max(sim.particles.capacity(), max(sim.maxParticles, count));
+
+	vector<Particle> placed;
+	placed.reserve(capacity);
+	FirstTouch(sim.pool, placed.data(), sizeof(Particle), count, placed.capacity());
+	placed.insert(placed.end(), sim.particles.begin(), sim.particles.end());
+	sim.particles.swap(placed);
+
+	ThreadPool* pool = sim.pool;
+	sim.grid.reserve(capacity, [pool, count](uint32_t* data, size_t reserved)
+	{
+		FirstTouch(pool, data, sizeof(uint32_t), min(count, reserved), reserved);
+	});
+}
@@ -0,0 +1,234 @@
+#include "obstacles.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace up
+{
+
+static const int BVH_LEAF_SIZE = 4;
+static const int BVH_STACK_SIZE = 64;
+
+static AABB SegmentBox(const Segment& s)
+{
+	AABB box;
+	box.grow(s.p1);
+	box.grow(s.p2);
+	return box;
+}
+
+static Vec2 ClosestPointOnSegment(const Segment& s, const Vec2& p)
+{
+	float len2 = s.d.length2();
+	if (len2 <= 0.0f) return s.p1;
+
+	float t = (p - s.p1).dot(s.d) / len2;
+	t = std::max(0.0f, std::min(1.0f, t));
+	return s.p1 + t*s.d;
+}
+
+// Narrows [tNear, tFar] to the times the ray is between lo and hi on one
+// axis. A ray parallel to the axis (infinite inv) is inside for all t or
+// for none; computing it would take 0 * inf when from is on the edge.
+static bool ClipSlab(float lo, float hi, float from, float inv, float& tNear, float& tFar)
+{
+	if (std::isinf(inv)) return from >= lo && from <= hi;
+
+	float t1 = (lo - from) * inv;
+	float t2 = (hi - from) * inv;
+	tNear = std::max(tNear, std::min(t1, t2));
+	tFar = std::min(tFar, std::max(t1, t2));
+	return true;
+}
+
+// Slab test of the ray from + t*dir against the box, for t in [0, tMax]
+static bool RayHitsBox(const AABB& box, const Vec2& from, const Vec2& invDir, float tMax)
+{
+	float tNear = -INFINITY, tFar = INFINITY;
+	if (!ClipSlab(box.min.x, box.max.x, from.x, invDir.x, tNear, tFar)) return false;
+	if (!ClipSlab(box.min.y, box.max.y, from.y, invDir.y, tNear, tFar)) return false;
+
+	return tFar >= std::max(tNear, 0.0f) && tNear <= tMax;
+}
+
+void SegmentBVH::build(const std::vector<Segment>& segments)
+{
+	m_nodes.clear();
+	m_segments = segments;
+
+	if (m_segments.empty()) return;
+
+	m_nodes.reserve(2 * m_segments.size());
+	m_nodes.push_back(Node());
+	buildNode(0, 0, static_cast<int>(m_segments.size()));
+}
+
+// Builds the subtree over m_segments[first, first + count) into node index.
+// Children are allocated as a pair so the right child is always left + 1.
+void SegmentBVH::buildNode(int index, int first, int count)
+{
+	AABB box, centroids;
+	for (int i = first; i < first + count; i++)
+	{
+		box.grow(SegmentBox(m_segments[i]));
+		centroids.grow(getMidPoint(m_segments[i].p1, m_segments[i].p2));
+	}
+	m_nodes[index].box = box;
+
+	if (count <= BVH_LEAF_SIZE)
+	{
+		m_nodes[index].first = first;
+		m_nodes[index].count = count;
+		return;
+	}
+
+	// Median split along the longest axis of the centroid bounds
+	bool splitX = centroids.max.x - centroids.min.x >= centroids.max.y - centroids.min.y;
+	int half = count / 2;
+	std::nth_element(m_segments.begin() + first, m_segments.begin() + first + half, m_segments.begin() + first + count,
+		[splitX](const Segment& a, const Segment& b)
+		{
+			return splitX ? a.p1.x + a.p2.x < b.p1.x + b.p2.x : a.p1.y + a.p2.y < b.p1.y + b.p2.y;
+		});
+
+	int left = static_cast<int>(m_nodes.size());
+	m_nodes[index].first = left;
+	m_nodes[index].count = 0;
+	m_nodes.push_back(Node());
+	m_nodes.push_back(Node());
+
+	buildNode(left, first, half);
+	buildNode(left + 1, first + half, count - half);
+}
+
+bool SegmentBVH::closest(const Vec2& p, float maxDistance, WallContact& contact) const
+{
+	if (m_nodes.empty()) return false;
+
+	float best2 = maxDistance * maxDistance;
+	int bestSegment = -1;
+	Vec2 bestPoint;
+
+	int stack[BVH_STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node& node = m_nodes[stack[--top]];
+		if (node.box.distance2(p) >= best2) continue;
+
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				Vec2 c = ClosestPointOnSegment(m_segments[i], p);
+				float d2 = (p - c).length2();
+				if (d2 < best2)
+				{
+					best2 = d2;
+					bestSegment = i;
+					bestPoint = c;
+				}
+			}
+		}
+		else
+		{
+			// Visit the nearer child first so it tightens best2 early
+			int near = node.first, far = node.first + 1;
+			if (m_nodes[far].box.distance2(p) < m_nodes[near].box.distance2(p)) std::swap(near, far);
+			stack[top++] = far;
+			stack[top++] = near;
+		}
+	}
+
+	if (bestSegment < 0) return false;
+
+	contact.distance = sqrt(best2);
+	contact.point = bestPoint;
+	contact.segment = bestSegment;
+
+	if (contact.distance > 0.0f)
+	{
+		contact.normal = (p - bestPoint) * (1.0f / contact.distance);
+	}
+	else
+	{
+		contact.normal = m_segments[bestSegment].d.getNormal().normalized();
+	}
+
+	return true;
+}
+
+bool SegmentBVH::sweep(const Vec2& from, const Vec2& to, WallHit& hit) const
+{
+	if (m_nodes.empty()) return false;
+
+	Vec2 dir = to - from;
+	Vec2 invDir(1.0f / dir.x, 1.0f / dir.y);
+	Segment motion(from, to);
+
+	float bestT = 1.0f;
+	int bestSegment = -1;
+	Vec2 bestPoint;
+
+	int stack[BVH_STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node& node = m_nodes[stack[--top]];
+		if (!RayHitsBox(node.box, from, invDir, bestT)) continue;
+
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				Intersection inter(motion, m_segments[i]);
+				if (inter.cross && inter.t <= bestT)
+				{
+					bestT = inter.t;
+					bestSegment = i;
+					bestPoint = inter.point;
+				}
+			}
+		}
+		else
+		{
+			stack[top++] = node.first + 1;
+			stack[top++] = node.first;
+		}
+	}
+
+	if (bestSegment < 0) return false;
+
+	const Segment& s = m_segments[bestSegment];
+	hit.t = bestT;
+	hit.point = bestPoint;
+	hit.segment = bestSegment;
+	hit.normal = s.d.getNormal().normalized();
+	if (hit.normal.dot(dir) > 0.0f) hit.normal = -hit.normal;
+
+	return true;
+}
+
+void Obstacles::rebuild()
+{
+	std::vector<Segment> segments;
+
+	for (const Polygon& poly : polygons)
+	{
+		size_t n = poly.points.size();
+		if (n < 2) continue;
+
+		for (size_t i = 0; i + 1 < n; i++)
+			segments.push_back(Segment(poly.points[i], poly.points[i + 1]));
+		if (poly.closed && n > 2)
+			segments.push_back(Segment(poly.points[n - 1], poly.points[0]));
+	}
+
+	bvh.build(segments);
+}
+
+}
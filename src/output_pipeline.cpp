@@ -0,0 +1,118 @@
+#include "output_pipeline.hpp"
+#include "trace.hpp"
+
+const static unsigned MAX_DECIMATION = 1024;
+
+OutputPipeline::~OutputPipeline()
+{
+	stop();
+}
+
+void OutputPipeline::start(const Sink& sink, size_t buffers, BackpressurePolicy policy)
+{
+	stop();
+
+	m_sink = sink;
+	m_policy = policy;
+	if (buffers < 1) buffers = 1;
+
+	m_storage.clear();
+	m_pool.clear();
+	for (size_t i = 0; i < buffers; i++)
+	{
+		m_storage.emplace_back(new OutputFrame());
+		m_pool.push_back(m_storage.back().get());
+	}
+
+	m_queue.assign(buffers, nullptr);
+	m_head = m_count = 0;
+	m_stop = false;
+	m_decimation = 1;
+	m_offered = m_written = m_dropped = 0;
+
+	m_thread = std::thread(&OutputPipeline::run, this);
+}
+
+void OutputPipeline::stop()
+{
+	if (!m_thread.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_queued.notify_one();
+	m_thread.join();
+}
+
+OutputFrame* OutputPipeline::acquire()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_offered++;
+	if (m_policy == BackpressurePolicy::Decimate && m_offered % m_decimation != 0)
+	{
+		m_dropped++;
+		return nullptr;
+	}
+
+	if (m_pool.empty())
+	{
+		if (m_policy == BackpressurePolicy::Block)
+		{
+			TraceScope trace("output backpressure");
+			m_freed.wait(lock, [this] { return !m_pool.empty(); });
+		}
+		else
+		{
+			if (m_policy == BackpressurePolicy::Decimate && m_decimation < MAX_DECIMATION) m_decimation *= 2;
+			m_dropped++;
+			return nullptr;
+		}
+	}
+
+	OutputFrame* frame = m_pool.back();
+	m_pool.pop_back();
+	return frame;
+}
+
+void OutputPipeline::submit(OutputFrame* frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queue[(m_head + m_count) % m_queue.size()] = frame;
+		m_count++;
+	}
+	m_queued.notify_one();
+}
+
+void OutputPipeline::run()
+{
+	SetTraceThreadName("output writer");
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_queued.wait(lock, [this] { return m_count > 0 || m_stop; });
+		if (m_count == 0) break;
+
+		OutputFrame* frame = m_queue[m_head];
+		m_head = (m_head + 1) % m_queue.size();
+		m_count--;
+
+		// serialize without holding the lock so the solver can keep submitting
+		lock.unlock();
+		{
+			TraceScope trace("write frame");
+			m_sink(*frame);
+		}
+		lock.lock();
+
+		m_written++;
+		m_pool.push_back(frame);
+		if (m_count == 0 && m_decimation > 1) m_decimation /= 2;
+
+		m_freed.notify_one();
+	}
+}
@@ -0,0 +1,125 @@
+#include "particle_store.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace Eigen;
+
+void ReserveParticles(Simulation& sim)
+{
+	sim.particles.reserve(max(sim.maxParticles, sim.particles.size()));
+	sim.freeSlots.reserve(sim.particles.capacity());
+}
+
+bool SpawnParticle(Simulation& sim, const Particle& p)
+{
+	if (!sim.freeSlots.empty())
+	{
+		sim.particles[sim.freeSlots.back()] = p;
+		sim.freeSlots.pop_back();
+		return true;
+	}
+
+	if (sim.maxParticles && sim.particles.size() >= sim.maxParticles) return false;
+
+	sim.particles.push_back(p);
+	return true;
+}
+
+void RemoveParticle(Simulation& sim, size_t i)
+{
+	sim.freeSlots.push_back(static_cast<uint32_t>(i));
+}
+
+void CompactParticles(Simulation& sim)
+{
+	vector<Particle>& particles = sim.particles;
+	vector<uint32_t>& holes = sim.freeSlots;
+	if (holes.empty()) return;
+
+	sort(holes.begin(), holes.end());
+
+	// fill the lowest hole with the last particle, unless that is a hole too
+	size_t first = 0, last = holes.size();
+	size_t end = particles.size();
+	while (first < last)
+	{
+		if (holes[last - 1] == end - 1) last--;
+		else particles[holes[first++]] = particles[end - 1];
+		end--;
+	}
+
+	particles.erase(particles.begin() + end, particles.end());
+	holes.clear();
+}
+
+static bool Inside(double x, double y, float x0, float y0, float x1, float y1)
+{
+	return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+}
+
+void ApplyEmittersAndSinks(Simulation& sim)
+{
+	if (sim.emitters.empty() && sim.sinks.empty()) return;
+
+	for (const Sink& sink : sim.sinks)
+	{
+		for (size_t i = 0; i < sim.particles.size(); i++)
+		{
+			const Particle& p = sim.particles[i];
+			if (!p.isBoundary && Inside(p.x(0), p.x(1), sink.x0, sink.y0, sink.x1, sink.y1)) RemoveParticle(sim, i);
+		}
+	}
+
+	// a particle hit by two sinks is only freed once
+	sort(sim.freeSlots.begin(), sim.freeSlots.end());
+	sim.freeSlots.erase(unique(sim.freeSlots.begin(), sim.freeSlots.end()), sim.freeSlots.end());
+
+	const float H = sim.params.h;
+	for (size_t e = 0; e < sim.emitters.size(); e++)
+	{
+		Emitter& emitter = sim.emitters[e];
+		const CounterRng jitterRng(sim.params.seed ^ Mix64(e + 1));
+
+		int cols = static_cast<int>((emitter.x1 - emitter.x0) / H) + 1;
+		int rows = static_cast<int>((emitter.y1 - emitter.y0) / H) + 1;
+		size_t slots = static_cast<size_t>(cols) * rows;
+
+		emitter.pending += emitter.rate * sim.dt;
+		if (emitter.pending < 1.0) continue;
+
+		// spawning on top of fluid that has not moved on yet would blow
+		// the density up, so lattice points within H/2 of fluid are skipped
+		emitter.occupied.assign(slots, 0);
+		for (size_t i = 0; i < sim.particles.size(); i++)
+		{
+			const Particle& p = sim.particles[i];
+			if (p.isBoundary) continue;
+
+			int c = static_cast<int>(floor((p.x(0) - emitter.x0) / H + 0.5));
+			int r = static_cast<int>(floor((p.x(1) - emitter.y0) / H + 0.5));
+			if (c >= 0 && c < cols && r >= 0 && r < rows) emitter.occupied[r * cols + c] = 1;
+		}
+
+		for (size_t tried = 0; emitter.pending >= 1.0 && tried < slots; tried++)
+		{
+			size_t slot = emitter.cursor++ % slots;
+			if (emitter.occupied[slot]) continue;
+
+			float x = emitter.x0 + (slot % cols) * H + jitterRng.uniform(emitter.emitted);
+			float y = emitter.y0 + (slot / cols) * H;
+
+			Particle p(x, y, sim.params.restDens, false);
+			p.v = emitter.velocity.cast<Real>();
+			if (!SpawnParticle(sim, p)) break;
+
+			emitter.emitted++;
+			emitter.pending -= 1.0;
+		}
+
+		// a blocked inlet or a full store drops the backlog instead of
+		// bursting later
+		emitter.pending = min(emitter.pending, 1.0);
+	}
+}
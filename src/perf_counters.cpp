@@ -0,0 +1,174 @@
+#include "perf_counters.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* PERF_COUNTER_NAMES[PERF_COUNTER_COUNT] =
+{
+	"cycles",
+	"instructions",
+	"L1D misses",
+	"LLC misses",
+	"branch misses",
+};
+
+const char* PerfCounterName(PerfCounter counter)
+{
+	return PERF_COUNTER_NAMES[counter];
+}
+
+// Counters of one thread, opened as a group so one read returns them all
+struct PerfGroup
+{
+	int leader = -1;
+	int slot[PERF_COUNTER_COUNT];	// position in the group read, -1 if unavailable
+	int members = 0;
+};
+
+// Groups of every thread that enabled counters. Entries are filled under
+// the mutex and then published by the count, so reads need no lock.
+const static unsigned MAX_PERF_THREADS = 256;
+static PerfGroup perfGroups[MAX_PERF_THREADS];
+static std::atomic<unsigned> perfGroupCount(0);
+static std::mutex perfMutex;
+static thread_local bool perfThreadEnabled = false;
+
+#ifdef __linux__
+
+static int OpenCounter(uint32_t type, uint64_t config, int groupFd)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = groupFd < 0 ? 1 : 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+
+static bool EnableThreadCounters(std::string& error)
+{
+	if (perfThreadEnabled) return true;
+
+	std::lock_guard<std::mutex> lock(perfMutex);
+	unsigned count = perfGroupCount.load(std::memory_order_relaxed);
+	if (count == MAX_PERF_THREADS)
+	{
+		error = "too many threads for hardware counters";
+		return false;
+	}
+
+	const struct { uint32_t type; uint64_t config; } events[PERF_COUNTER_COUNT] =
+	{
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	};
+
+	PerfGroup group;
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+	{
+		group.slot[i] = -1;
+
+		int fd = OpenCounter(events[i].type, events[i].config, group.leader);
+		if (fd < 0)
+		{
+			if (group.leader < 0) error = std::string("perf_event_open: ") + strerror(errno);
+			continue;
+		}
+
+		if (group.leader < 0) group.leader = fd;
+		group.slot[i] = group.members++;
+	}
+
+	if (group.leader < 0) return false;
+
+	ioctl(group.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(group.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	perfGroups[count] = group;
+	perfGroupCount.store(count + 1, std::memory_order_release);
+	perfThreadEnabled = true;
+	return true;
+}
+
+bool EnablePerfCounters(std::string& error, ThreadPool* pool)
+{
+	if (!EnableThreadCounters(error)) return false;
+
+	// one index per thread, the caller's already open
+	if (pool) pool->parallelFor(pool->size(), [](size_t, size_t)
+	{
+		std::string ignored;
+		EnableThreadCounters(ignored);
+	}, "perf counters");
+	return true;
+}
+
+void ReadPerfCounters(PerfCounts& counts)
+{
+	memset(&counts, 0, sizeof(counts));
+	unsigned groups = perfGroupCount.load(std::memory_order_acquire);
+
+	for (unsigned g = 0; g < groups; g++)
+	{
+		const PerfGroup& group = perfGroups[g];
+
+		// nr, time_enabled, time_running, then one value per member
+		uint64_t buffer[3 + PERF_COUNTER_COUNT];
+		if (read(group.leader, buffer, sizeof(buffer)) < static_cast<ssize_t>((3 + group.members) * sizeof(uint64_t))) continue;
+
+		// the group is scheduled as a whole, so one factor corrects all members
+		double scale = buffer[2] > 0 ? static_cast<double>(buffer[1]) / buffer[2] : 1.0;
+
+		for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+			if (group.slot[i] >= 0) counts.values[i] += static_cast<uint64_t>(buffer[3 + group.slot[i]] * scale);
+	}
+}
+
+#else
+
+bool EnablePerfCounters(std::string& error, ThreadPool*)
+{
+	error = "hardware counters are only supported on Linux";
+	return false;
+}
+
+void ReadPerfCounters(PerfCounts& counts)
+{
+	memset(&counts, 0, sizeof(counts));
+}
+
+#endif
+
+bool PerfCountersEnabled()
+{
+	return perfGroupCount.load(std::memory_order_acquire) > 0;
+}
+
+// Every thread opens the same events, so the first group speaks for all
+bool PerfCounterAvailable(PerfCounter counter)
+{
+	return PerfCountersEnabled() && perfGroups[0].slot[counter] >= 0;
+}
+
+unsigned PerfCounterThreads()
+{
+	return perfGroupCount.load(std::memory_order_acquire);
+}
@@ -0,0 +1,142 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+const size_t PhaseRing::CAPACITY;
+
+static PhaseRing phaseRings[PHASE_COUNT];
+
+// whole-run hardware counter totals per phase
+static std::atomic<uint64_t> phaseCounters[PHASE_COUNT][PERF_COUNTER_COUNT];
+static std::atomic<uint64_t> phaseCounterCalls[PHASE_COUNT];
+
+static const char* PHASE_NAMES[PHASE_COUNT] =
+{
+	"neighbors",
+	"density",
+	"forces",
+	"integration",
+	"output",
+	"render",
+};
+
+const char* PhaseName(ProfilePhase phase)
+{
+	return PHASE_NAMES[phase];
+}
+
+void PhaseRing::push(float ms)
+{
+	// each writer claims its own slot; concurrent ones never lose a sample
+	uint64_t n = m_count.fetch_add(1, std::memory_order_acq_rel);
+	m_samples[n % CAPACITY].store(ms, std::memory_order_relaxed);
+
+	double total = m_totalMs.load(std::memory_order_relaxed);
+	while (!m_totalMs.compare_exchange_weak(total, total + ms, std::memory_order_relaxed)) {}
+}
+
+PhaseStats PhaseRing::stats() const
+{
+	float window[CAPACITY];
+	uint64_t n = std::min<uint64_t>(m_count.load(std::memory_order_acquire), CAPACITY);
+
+	PhaseStats s = { n, 0.0, 0.0, 0.0 };
+	if (n == 0) return s;
+
+	double sum = 0.0;
+	for (uint64_t i = 0; i < n; i++)
+	{
+		window[i] = m_samples[i].load(std::memory_order_relaxed);
+		sum += window[i];
+	}
+
+	size_t p99 = static_cast<size_t>(0.99 * (n - 1));
+	std::nth_element(window, window + p99, window + n);
+
+	s.minMs = *std::min_element(window, window + n);
+	s.avgMs = sum / n;
+	s.p99Ms = window[p99];
+	return s;
+}
+
+void RecordPhase(ProfilePhase phase, float ms)
+{
+	phaseRings[phase].push(ms);
+}
+
+void RecordPhaseCounters(ProfilePhase phase, const PerfCounts& start, const PerfCounts& end)
+{
+	for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+		phaseCounters[phase][c].fetch_add(end.values[c] - start.values[c], std::memory_order_relaxed);
+	phaseCounterCalls[phase].fetch_add(1, std::memory_order_relaxed);
+}
+
+PhaseStats GetPhaseStats(ProfilePhase phase)
+{
+	return phaseRings[phase].stats();
+}
+
+void DumpProfile(std::ostream& out)
+{
+	out << "Phase timings (ms): last " << PhaseRing::CAPACITY << " samples min/avg/p99, whole run calls/avg" << std::endl;
+	out << std::fixed << std::setprecision(3);
+
+	for (int i = 0; i < PHASE_COUNT; i++)
+	{
+		const PhaseRing& ring = phaseRings[i];
+		PhaseStats s = ring.stats();
+		uint64_t calls = ring.total();
+
+		out << "  " << std::left << std::setw(12) << PHASE_NAMES[i] << std::right;
+		if (calls == 0)
+		{
+			out << "  not run" << std::endl;
+			continue;
+		}
+		out << std::setw(10) << s.minMs << std::setw(10) << s.avgMs << std::setw(10) << s.p99Ms
+			<< std::setw(10) << calls << std::setw(10) << ring.totalMs() / calls << std::endl;
+	}
+
+	if (!PerfCountersEnabled())
+	{
+		out << std::defaultfloat;
+		return;
+	}
+
+	// IPC well below 1 together with many LLC misses per kilo-instruction
+	// points to a memory-bound phase, a high IPC to a compute-bound one
+	out << "Hardware counters per call, summed over " << PerfCounterThreads() << " threads (n/a when hidden by the host):" << std::endl;
+	out << "  " << std::left << std::setw(12) << "phase" << std::right;
+	for (int c = 0; c < PERF_COUNTER_COUNT; c++) out << std::setw(15) << PerfCounterName(static_cast<PerfCounter>(c));
+	out << std::setw(8) << "IPC" << std::setw(10) << "LLC MPKI" << std::endl;
+
+	for (int i = 0; i < PHASE_COUNT; i++)
+	{
+		uint64_t calls = phaseCounterCalls[i].load(std::memory_order_relaxed);
+		if (calls == 0) continue;
+
+		double perCall[PERF_COUNTER_COUNT];
+		for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+			perCall[c] = static_cast<double>(phaseCounters[i][c].load(std::memory_order_relaxed)) / calls;
+
+		out << "  " << std::left << std::setw(12) << PHASE_NAMES[i] << std::right << std::setprecision(0);
+		for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+		{
+			if (PerfCounterAvailable(static_cast<PerfCounter>(c))) out << std::setw(15) << perCall[c];
+			else out << std::setw(15) << "n/a";
+		}
+
+		out << std::setprecision(2);
+		bool instructions = PerfCounterAvailable(PERF_INSTRUCTIONS) && perCall[PERF_INSTRUCTIONS] > 0;
+		if (instructions && PerfCounterAvailable(PERF_CYCLES) && perCall[PERF_CYCLES] > 0)
+			out << std::setw(8) << perCall[PERF_INSTRUCTIONS] / perCall[PERF_CYCLES];
+		else out << std::setw(8) << "n/a";
+		if (instructions && PerfCounterAvailable(PERF_LLC_MISSES))
+			out << std::setw(10) << 1000.0 * perCall[PERF_LLC_MISSES] / perCall[PERF_INSTRUCTIONS];
+		else out << std::setw(10) << "n/a";
+		out << std::endl;
+	}
+
+	out << std::setprecision(3) << std::defaultfloat;
+}
@@ -0,0 +1,298 @@
+#include "scene.hpp"
+#include "particle_store.hpp"
+#include "sph.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+Scene::Scene()
+{
+	// the original layout: 100 jittered fluid particles dropped above a
+	// strip of 63 boundary particles
+	fluid.push_back(ParticleBlock{ 200.f, 316.f, 400.f, 868.f, 100 });
+	boundary.push_back(ParticleBlock{ 100.f, 516.f, 800.f / 1.5f - 100.f, 868.f, 63 });
+}
+
+// Reads exactly count numbers from value
+template<class T>
+static bool ParseValues(const std::string& value, T* out, int count)
+{
+	std::istringstream ss(value);
+	for (int i = 0; i < count; i++)
+		if (!(ss >> out[i])) return false;
+
+	std::string rest;
+	return !(ss >> rest);
+}
+
+template<class T>
+static bool ParseValue(const std::string& value, T& out)
+{
+	return ParseValues(value, &out, 1);
+}
+
+static bool ParseSwitch(const std::string& value, bool& out)
+{
+	if (value == "on") out = true;
+	else if (value == "off") out = false;
+	else return false;
+	return true;
+}
+
+static bool ParseNumaMode(const std::string& value, NumaMode& out)
+{
+	if (value == "auto") out = NumaMode::Auto;
+	else if (value == "on") out = NumaMode::On;
+	else if (value == "off") out = NumaMode::Off;
+	else return false;
+	return true;
+}
+
+static bool ParseBlock(const std::string& value, ParticleBlock& block)
+{
+	std::istringstream ss(value);
+	if (!(ss >> block.x0 >> block.y0 >> block.x1 >> block.y1)) return false;
+
+	block.maxCount = static_cast<size_t>(-1);
+
+	std::string count, rest;
+	if ((ss >> count) && !ParseValue(count, block.maxCount)) return false;
+	return !(ss >> rest);
+}
+
+bool SetSceneValue(Scene& scene, const std::string& key, const std::string& value, std::string& error)
+{
+	SimParams& p = scene.params;
+	bool ok = true;
+
+	if (key == "h") ok = ParseValue(value, p.h) && p.h > 0.f;
+	else if (key == "eps") ok = ParseValue(value, p.eps) && p.eps >= 0.f;
+	else if (key == "mass") ok = ParseValue(value, p.mass) && p.mass > 0.f;
+	else if (key == "visc") ok = ParseValue(value, p.visc);
+	else if (key == "rest-density") ok = ParseValue(value, p.restDens) && p.restDens > 0.f;
+	else if (key == "stiffness") ok = ParseValue(value, p.stiffness);
+	else if (key == "dt") ok = ParseValue(value, p.dt) && p.dt > 0.f;
+	else if (key == "bound-damping") ok = ParseValue(value, p.boundDamping);
+	else if (key == "gravity")
+	{
+		float g[2];	// single precision like the other constants
+		ok = ParseValues(value, g, 2);
+		if (ok) p.gravity = Eigen::Vector2d(g[0], g[1]);
+	}
+	else if (key == "domain")
+	{
+		double d[2];
+		ok = ParseValues(value, d, 2) && d[0] > 0.0 && d[1] > 0.0;
+		if (ok)
+		{
+			p.viewWidth = d[0];
+			p.viewHeight = d[1];
+		}
+	}
+	else if (key == "walls") ok = ParseSwitch(value, p.walls);
+	else if (key == "periodic")
+	{
+		if (value == "none" || value == "x" || value == "y" || value == "xy")
+		{
+			p.periodicX = value.find('x') != std::string::npos;
+			p.periodicY = value.find('y') != std::string::npos;
+		}
+		else ok = false;
+	}
+	else if (key == "eos")
+	{
+		if (value == "linear") p.eos = EquationOfState::Linear;
+		else if (value == "tait") p.eos = EquationOfState::Tait;
+		else ok = false;
+	}
+	else if (key == "sleep-speed") ok = ParseValue(value, p.sleepSpeed) && p.sleepSpeed >= 0.f;
+	else if (key == "sleep-density") ok = ParseValue(value, p.sleepDensity) && p.sleepDensity >= 0.f;
+	else if (key == "sleep-steps") ok = ParseValue(value, p.sleepSteps);
+	else if (key == "adapt-levels") ok = ParseValue(value, p.adaptLevels) && p.adaptLevels <= MAX_ADAPT_LEVELS;
+	else if (key == "adapt-every") ok = ParseValue(value, p.adaptEvery) && p.adaptEvery > 0;
+	else if (key == "split-density") ok = ParseValue(value, p.splitDensity) && p.splitDensity >= 0.f;
+	else if (key == "merge-density") ok = ParseValue(value, p.mergeDensity) && p.mergeDensity >= 0.f;
+	else if (key == "split-distance") ok = ParseValue(value, p.splitDistance) && p.splitDistance >= 0.f;
+	else if (key == "balance-every") ok = ParseValue(value, p.balanceEvery);
+	else if (key == "seed") ok = ParseValue(value, p.seed);
+	else if (key == "deterministic") ok = ParseSwitch(value, p.deterministic);
+	else if (key == "fluid" || key == "boundary")
+	{
+		ParticleBlock block;
+		ok = ParseBlock(value, block);
+		if (ok) (key == "fluid" ? scene.fluid : scene.boundary).push_back(block);
+	}
+	else if (key == "emitter")
+	{
+		float e[7];
+		ok = ParseValues(value, e, 7) && e[6] > 0.f;
+		if (ok)
+		{
+			Emitter emitter;
+			emitter.x0 = e[0]; emitter.y0 = e[1]; emitter.x1 = e[2]; emitter.y1 = e[3];
+			emitter.velocity = Eigen::Vector2d(e[4], e[5]);
+			emitter.rate = e[6];
+			scene.emitters.push_back(emitter);
+		}
+	}
+	else if (key == "sink")
+	{
+		float r[4];
+		ok = ParseValues(value, r, 4);
+		if (ok) scene.sinks.push_back(Sink{ r[0], r[1], r[2], r[3] });
+	}
+	else if (key == "max-particles") ok = ParseValue(value, scene.maxParticles);
+	else if (key == "output-every") ok = ParseValue(value, scene.outputEvery) && scene.outputEvery > 0;
+	else if (key == "output-buffers") ok = ParseValue(value, scene.outputBuffers) && scene.outputBuffers > 0;
+	else if (key == "output-policy")
+	{
+		if (value == "block") scene.outputPolicy = BackpressurePolicy::Block;
+		else if (value == "drop") scene.outputPolicy = BackpressurePolicy::Drop;
+		else if (value == "decimate") scene.outputPolicy = BackpressurePolicy::Decimate;
+		else ok = false;
+	}
+	else if (key == "checkpoint-every") ok = ParseValue(value, scene.checkpointEvery);
+	else if (key == "threads")
+	{
+		ok = ParseValue(value, scene.threads);
+		if (ok && scene.threads == 0) scene.threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	else if (key == "first-touch") ok = ParseNumaMode(value, scene.firstTouch);
+	else if (key == "pin-threads") ok = ParseNumaMode(value, scene.pinThreads);
+	else
+	{
+		error = "unknown setting '" + key + "'";
+		return false;
+	}
+
+	if (!ok) error = "bad value '" + value + "' for " + key;
+	return ok;
+}
+
+bool SetSceneOverride(Scene& scene, const std::string& assignment, std::string& error)
+{
+	size_t eq = assignment.find('=');
+	if (eq == std::string::npos)
+	{
+		error = "expected key=value, got '" + assignment + "'";
+		return false;
+	}
+
+	return SetSceneValue(scene, assignment.substr(0, eq), assignment.substr(eq + 1), error);
+}
+
+SceneLoad LoadScene(const std::string& path, Scene& scene, std::string& error)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		error = "cannot open " + path;
+		return SceneLoad::Missing;
+	}
+
+	// parsed into a copy, so a bad line leaves scene as it was
+	Scene loaded = scene;
+
+	std::string line;
+	int lineNumber = 0;
+	up::Polygon* current = nullptr;
+	bool fluidSeen = false, boundarySeen = false;
+
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+		std::string where = path + ":" + std::to_string(lineNumber) + ": ";
+
+		size_t comment = line.find('#');
+		if (comment != std::string::npos) line.erase(comment);
+
+		std::istringstream ss(line);
+		std::string keyword;
+		if (!(ss >> keyword)) continue;
+
+		std::string value;
+		std::getline(ss >> std::ws, value);
+		while (!value.empty() && isspace(static_cast<unsigned char>(value.back()))) value.pop_back();
+
+		if (current)
+		{
+			if (keyword == "end")
+			{
+				current = nullptr;
+				continue;
+			}
+
+			float xy[2];
+			if (!ParseValues(line, xy, 2))
+			{
+				error = where + "expected 'x y' or 'end'";
+				return SceneLoad::Invalid;
+			}
+			current->points.push_back(up::Vec2(xy[0], xy[1]));
+		}
+		else if (keyword == "polygon")
+		{
+			if (value.empty()) value = "closed";
+			if (value != "closed" && value != "open")
+			{
+				error = where + "expected 'polygon closed|open'";
+				return SceneLoad::Invalid;
+			}
+			loaded.obstacles.push_back(up::Polygon());
+			current = &loaded.obstacles.back();
+			current->closed = value == "closed";
+		}
+		else
+		{
+			if (keyword == "fluid" && !fluidSeen)
+			{
+				loaded.fluid.clear();
+				fluidSeen = true;
+			}
+			if (keyword == "boundary" && !boundarySeen)
+			{
+				loaded.boundary.clear();
+				boundarySeen = true;
+			}
+
+			std::string settingError;
+			if (!SetSceneValue(loaded, keyword, value, settingError))
+			{
+				error = where + settingError;
+				return SceneLoad::Invalid;
+			}
+		}
+	}
+
+	if (current)
+	{
+		error = path + ": unterminated polygon";
+		return SceneLoad::Invalid;
+	}
+
+	scene = loaded;
+	return SceneLoad::Loaded;
+}
+
+void SetupSimulation(Simulation& sim, const Scene& scene)
+{
+	SetParams(sim, scene.params);
+
+	sim.obstacles.polygons = scene.obstacles;
+	sim.obstacles.rebuild();
+
+	sim.emitters = scene.emitters;
+	sim.sinks = scene.sinks;
+	sim.maxParticles = scene.maxParticles;
+
+	sim.particles.clear();
+	sim.freeSlots.clear();
+	sim.rng = Rng(scene.params.seed);
+	sim.stepCount = 0;
+	sim.simTime = 0.0;
+	InitParticles(sim, scene.fluid, scene.boundary);
+	ReserveParticles(sim);
+}
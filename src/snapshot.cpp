@@ -0,0 +1,310 @@
+#include "snapshot.hpp"
+#include "text_writer.hpp"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char SNAPSHOT_MAGIC[8] = { 'F', 'S', 'I', 'M', 'S', 'N', 'A', 'P' };
+
+static const uint64_t SNAPSHOT_FRAME_TAG = 0x454d415246534946ull;	// "FISFRAME"
+
+static const SnapshotAttribute SNAPSHOT_ATTRIBUTES[SNAP_ATTRIBUTE_COUNT] =
+{
+	{ "x", SNAPSHOT_FLOAT32, 1 },
+	{ "y", SNAPSHOT_FLOAT32, 1 },
+	{ "vx", SNAPSHOT_FLOAT32, 1 },
+	{ "vy", SNAPSHOT_FLOAT32, 1 },
+	{ "rho", SNAPSHOT_FLOAT32, 1 },
+	{ "p", SNAPSHOT_FLOAT32, 1 },
+	{ "flags", SNAPSHOT_UINT8, 1 },
+};
+
+static size_t ElementSize(uint32_t type)
+{
+	return type == SNAPSHOT_FLOAT32 ? 4 : 1;
+}
+
+// Size of an attribute block including the padding to the next 8 bytes
+static size_t BlockSize(int attribute, size_t count)
+{
+	size_t bytes = ElementSize(SNAPSHOT_ATTRIBUTES[attribute].type) * count;
+	return (bytes + 7) & ~size_t(7);
+}
+
+static size_t FrameSize(size_t count)
+{
+	size_t size = sizeof(SnapshotFrameHeader);
+	for (int a = 0; a < SNAP_ATTRIBUTE_COUNT; a++) size += BlockSize(a, count);
+	return size;
+}
+
+static size_t FirstFrameOffset()
+{
+	return sizeof(SnapshotHeader) + sizeof(SNAPSHOT_ATTRIBUTES);
+}
+
+void SnapshotFrame::resize(size_t n)
+{
+	x.resize(n);
+	y.resize(n);
+	vx.resize(n);
+	vy.resize(n);
+	rho.resize(n);
+	p.resize(n);
+	flags.resize(n);
+}
+
+void WriteFrameCsv(TextWriter& out, const SnapshotFrame& frame)
+{
+	for (int a = 0; a < SNAP_ATTRIBUTE_COUNT; a++) out << (a ? "," : "") << SNAPSHOT_ATTRIBUTES[a].name;
+	out << '\n';
+
+	for (size_t i = 0; i < frame.size(); i++)
+	{
+		out << frame.x[i] << ',' << frame.y[i] << ',' << frame.vx[i] << ',' << frame.vy[i] << ','
+			<< frame.rho[i] << ',' << frame.p[i] << ',' << frame.flags[i] << '\n';
+	}
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+	close();
+}
+
+bool SnapshotWriter::open(const std::string& path)
+{
+	close();
+
+	m_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!m_file.is_open()) return false;
+
+	m_index.clear();
+	writeHeader(0);
+	m_file.write(reinterpret_cast<const char*>(SNAPSHOT_ATTRIBUTES), sizeof(SNAPSHOT_ATTRIBUTES));
+	m_offset = FirstFrameOffset();
+
+	return m_file.good();
+}
+
+void SnapshotWriter::writeHeader(uint64_t indexOffset)
+{
+	SnapshotHeader header;
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.headerSize = sizeof(SnapshotHeader);
+	header.attributeCount = SNAP_ATTRIBUTE_COUNT;
+	header.reserved = 0;
+	header.frameCount = m_index.size();
+	header.indexOffset = indexOffset;
+
+	m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+bool SnapshotWriter::write(const SnapshotFrame& frame)
+{
+	if (!m_file.is_open()) return false;
+
+	size_t n = frame.size();
+
+	SnapshotFrameHeader fh;
+	fh.step = frame.step;
+	fh.time = frame.time;
+	fh.particleCount = n;
+	fh.tag = SNAPSHOT_FRAME_TAG;
+	m_file.write(reinterpret_cast<const char*>(&fh), sizeof(fh));
+
+	const void* blocks[SNAP_ATTRIBUTE_COUNT] =
+	{
+		frame.x.data(), frame.y.data(), frame.vx.data(), frame.vy.data(),
+		frame.rho.data(), frame.p.data(), frame.flags.data()
+	};
+
+	static const char padding[8] = {};
+	for (int a = 0; a < SNAP_ATTRIBUTE_COUNT; a++)
+	{
+		size_t bytes = ElementSize(SNAPSHOT_ATTRIBUTES[a].type) * n;
+		m_file.write(static_cast<const char*>(blocks[a]), bytes);
+		m_file.write(padding, BlockSize(a, n) - bytes);
+	}
+
+	SnapshotIndexEntry entry;
+	entry.offset = m_offset;
+	entry.step = frame.step;
+	entry.time = frame.time;
+	entry.particleCount = n;
+	m_index.push_back(entry);
+
+	m_offset += FrameSize(n);
+
+	return m_file.good();
+}
+
+void SnapshotWriter::close()
+{
+	if (!m_file.is_open()) return;
+
+	m_file.write(reinterpret_cast<const char*>(m_index.data()), m_index.size() * sizeof(SnapshotIndexEntry));
+
+	// patch the header now that the frame count and index offset are known
+	m_file.seekp(0);
+	writeHeader(m_offset);
+	m_file.close();
+}
+
+SnapshotReader::~SnapshotReader()
+{
+	close();
+}
+
+bool SnapshotReader::open(const std::string& path, std::string& error)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(FirstFrameOffset()))
+	{
+		::close(fd);
+		error = path + " is too small to be a snapshot";
+		return false;
+	}
+
+	void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+	{
+		error = "cannot map " + path;
+		return false;
+	}
+
+	m_data = static_cast<const uint8_t*>(data);
+	m_size = st.st_size;
+
+	SnapshotHeader header;
+	memcpy(&header, m_data, sizeof(header));
+
+	// error may hold an earlier message, so only a local one decides
+	std::string failure;
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.headerSize != sizeof(SnapshotHeader))
+		failure = path + " is not a snapshot file";
+	else if (header.version == 0 || header.version > SNAPSHOT_VERSION)
+		failure = path + " has unsupported snapshot version " + std::to_string(header.version);
+	else if (header.attributeCount != SNAP_ATTRIBUTE_COUNT ||
+		memcmp(m_data + sizeof(header), SNAPSHOT_ATTRIBUTES, sizeof(SNAPSHOT_ATTRIBUTES)) != 0)
+		failure = path + " has an unexpected attribute layout";
+
+	if (!failure.empty())
+	{
+		error = failure;
+		close();
+		return false;
+	}
+
+	if (header.indexOffset == 0) return recoverIndex(error);
+
+	// bounded before multiplying, so a corrupt count cannot wrap around
+	if (header.indexOffset < FirstFrameOffset() || header.indexOffset > m_size ||
+		header.frameCount > (m_size - header.indexOffset) / sizeof(SnapshotIndexEntry))
+	{
+		error = path + " has a truncated frame index";
+		close();
+		return false;
+	}
+
+	size_t indexBytes = header.frameCount * sizeof(SnapshotIndexEntry);
+	m_index.resize(header.frameCount);
+	memcpy(m_index.data(), m_data + header.indexOffset, indexBytes);
+
+	for (const SnapshotIndexEntry& e : m_index)
+	{
+		// particleCount is bounded first, so FrameSize cannot overflow
+		if (e.offset < FirstFrameOffset() || e.offset > header.indexOffset || e.particleCount > m_size ||
+			FrameSize(e.particleCount) > header.indexOffset - e.offset)
+		{
+			error = path + " has a frame index pointing past the frames";
+			close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Rebuilds the index of a file that was not closed by its writer, keeping
+// every complete frame
+bool SnapshotReader::recoverIndex(std::string& error)
+{
+	size_t offset = FirstFrameOffset();
+
+	while (offset + sizeof(SnapshotFrameHeader) <= m_size)
+	{
+		SnapshotFrameHeader fh;
+		memcpy(&fh, m_data + offset, sizeof(fh));
+		if (fh.tag != SNAPSHOT_FRAME_TAG || fh.particleCount > m_size || offset + FrameSize(fh.particleCount) > m_size) break;
+
+		SnapshotIndexEntry entry;
+		entry.offset = offset;
+		entry.step = fh.step;
+		entry.time = fh.time;
+		entry.particleCount = fh.particleCount;
+		m_index.push_back(entry);
+
+		offset += FrameSize(fh.particleCount);
+	}
+
+	if (m_index.empty())
+	{
+		error = "snapshot has no complete frame";
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void SnapshotReader::close()
+{
+	if (m_data) munmap(const_cast<uint8_t*>(m_data), m_size);
+	m_data = nullptr;
+	m_size = 0;
+	m_index.clear();
+}
+
+SnapshotView SnapshotReader::frame(size_t i) const
+{
+	const SnapshotIndexEntry& e = m_index[i];
+	size_t n = e.particleCount;
+
+	SnapshotView view;
+	view.step = e.step;
+	view.time = e.time;
+	view.count = n;
+
+	const uint8_t* block = m_data + e.offset + sizeof(SnapshotFrameHeader);
+	const uint8_t* blocks[SNAP_ATTRIBUTE_COUNT];
+	for (int a = 0; a < SNAP_ATTRIBUTE_COUNT; a++)
+	{
+		blocks[a] = block;
+		block += BlockSize(a, n);
+	}
+
+	view.x = reinterpret_cast<const float*>(blocks[SNAP_X]);
+	view.y = reinterpret_cast<const float*>(blocks[SNAP_Y]);
+	view.vx = reinterpret_cast<const float*>(blocks[SNAP_VX]);
+	view.vy = reinterpret_cast<const float*>(blocks[SNAP_VY]);
+	view.rho = reinterpret_cast<const float*>(blocks[SNAP_RHO]);
+	view.p = reinterpret_cast<const float*>(blocks[SNAP_P]);
+	view.flags = blocks[SNAP_FLAGS];
+
+	return view;
+}
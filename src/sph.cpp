@@ -0,0 +1,551 @@
+#include "sph.hpp"
+#include "adaptive.hpp"
+#include "particle_store.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+using namespace Eigen;
+
+Simulation::Simulation()
+{
+	SetParams(*this, params);
+}
+
+void SetParams(Simulation& sim, const SimParams& params)
+{
+	sim.params = params;
+	sim.kernel = Kernel(params.h);
+	sim.dt = params.dt;
+
+	// each level halves the mass, so the area per particle halves too
+	size_t levels = min(params.adaptLevels, MAX_ADAPT_LEVELS) + 1;
+	sim.levelMass.resize(levels);
+	sim.levelH.resize(levels);
+	for(size_t l = 0; l < levels; l++)
+	{
+		sim.levelMass[l] = l == 0 ? params.mass : sim.levelMass[l - 1] * 0.5f;
+		sim.levelH[l] = l == 0 ? params.h : static_cast<float>(params.h / pow(sqrt(2.0), double(l)));
+	}
+
+	sim.pairKernels.clear();
+	for(size_t i = 0; i < levels; i++)
+		for(size_t j = 0; j < levels; j++)
+			sim.pairKernels.push_back(Kernel(0.5f * (sim.levelH[i] + sim.levelH[j])));
+}
+
+void InitParticles(Simulation& sim, const vector<ParticleBlock>& fluid, const vector<ParticleBlock>& boundary)
+{
+	const float H = sim.params.h;
+	const float REST_DENS = sim.params.restDens;
+	const CounterRng jitterRng(sim.params.seed);
+
+	for (const ParticleBlock& block : fluid)
+	{
+		size_t count = 0;
+		for (float y = block.y0; y <= block.y1; y += H)
+			for (float x = block.x0; x <= block.x1; x += H)
+				if (count < block.maxCount)
+				{
+					float jitter = sim.params.deterministic ? jitterRng.uniform(sim.particles.size()) : sim.rng.uniform();
+					sim.particles.push_back(Particle(x + jitter, y, REST_DENS, false));
+					count++;
+				}
+	}
+
+	for (const ParticleBlock& block : boundary)
+	{
+		size_t count = 0;
+		for (float y = block.y0; y <= block.y1; y += H)
+			for (float x = block.x0; x <= block.x1; x += H)
+				if (count < block.maxCount)
+				{
+					sim.particles.push_back(Particle(x, y, REST_DENS, true));
+					count++;
+				}
+	}
+}
+
+// Moves p along its velocity for dt. Every obstacle wall crossed by the path
+// reflects the particle at the time of impact and the rest of the step
+// continues from there, so fast particles cannot tunnel through thin walls.
+static void AdvanceWithCollisions(const up::Obstacles& obstacles, Particle& p, float dt, float skin, float damping)
+{
+	float remaining = 1.f;
+
+	for(int bounce = 0; bounce < MAX_CCD_BOUNCES; bounce++)
+	{
+		Vector2d target = p.x + (remaining*dt*p.v).cast<double>();
+
+		up::WallHit hit;
+		if(!obstacles.bvh.sweep(up::Vec2(p.x(0), p.x(1)), up::Vec2(target(0), target(1)), hit))
+		{
+			p.x = target;
+			return;
+		}
+
+		Vector2d n(hit.normal.x, hit.normal.y);
+		Vector2r nr = n.cast<Real>();
+		p.x = Vector2d(hit.point.x, hit.point.y) + skin * n;
+		p.v -= Real(1.0 - damping) * p.v.dot(nr) * nr;
+
+		remaining *= 1.f - hit.t;
+	}
+
+	// out of bounces: stay at the last impact point, on the near side of the wall
+}
+
+// Sleeping cells of the current grid, or null when sleeping is off or
+// UpdateSleep has not run on this grid
+static const uint8_t* SleepMask(const Simulation& sim)
+{
+	if(sim.params.sleepSpeed <= 0.f || sim.cellAsleep.size() != sim.grid.cellCount()) return nullptr;
+	return sim.cellAsleep.data();
+}
+
+// Runs body(i) on every owned particle. With a cell partition each thread
+// takes its part, and with timed the cells of a measured step record their
+// cost; otherwise the threads take equal index ranges.
+template<class F>
+static void ParallelForParticles(Simulation& sim, const char* name, bool timed, F body)
+{
+	CellPartition& partition = sim.partition;
+	if(partition.parts() == 0)
+	{
+		ParallelFor(sim.pool, OwnedCount(sim), name, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; i++) body(i);
+		});
+		return;
+	}
+
+	typedef chrono::steady_clock Clock;
+	const vector<uint32_t>& cellStart = sim.grid.cellStart();
+	const vector<uint32_t>& sorted = sim.grid.sorted();
+	const size_t owned = OwnedCount(sim);
+	const bool measure = timed && partition.measuring;
+
+	ParallelFor(sim.pool, partition.parts(), name, [&](size_t begin, size_t end)
+	{
+		for(uint32_t e = partition.partStart[begin]; e < partition.partStart[end]; e++)
+		{
+			uint32_t c = partition.cells[e];
+			Clock::time_point start = measure ? Clock::now() : Clock::time_point();
+			for(uint32_t k = cellStart[c]; k < cellStart[c + 1]; k++)
+				if(sorted[k] < owned) body(sorted[k]);
+			if(measure) partition.cellCost[c] = chrono::duration<float>(Clock::now() - start).count();
+		}
+	});
+}
+
+GridPeriod DomainPeriod(const SimParams& params)
+{
+	GridPeriod period;
+	if(params.periodicX) period.x = params.viewWidth;
+	if(params.periodicY) period.y = params.viewHeight;
+	return period;
+}
+
+IntegrationConstants::IntegrationConstants(const SimParams& params, float dt) :
+	dt(dt),
+	eps(params.boundaryEps()),
+	damping(params.boundDamping),
+	obstacleEps(0.5f * params.h),
+	ccdSkin(1e-3f * params.h),
+	width(params.viewWidth),
+	height(params.viewHeight),
+	walls(params.walls),
+	period(DomainPeriod(params))
+{}
+
+void IntegrateParticle(const IntegrationConstants& c, const up::Obstacles& obstacles, Particle& p)
+{
+	const float DT = c.dt;
+	const float EPS = c.eps;
+	const float BOUND_DAMPING = c.damping;
+	const float OBSTACLE_EPS = c.obstacleEps;
+	const double VIEW_WIDTH = c.width;
+	const double VIEW_HEIGHT = c.height;
+
+	// explicit Euler integration
+	p.v += DT*-p.f;
+	if(obstacles.empty()) p.x += (DT*p.v).cast<double>();
+	else AdvanceWithCollisions(obstacles, p, DT, c.ccdSkin, BOUND_DAMPING);
+
+	// enforce boundary conditions, unless the domain is open or the axis
+	// periodic
+	if(c.walls && c.period.x <= 0.0)
+	{
+		if(p.x(0)-EPS < 0.0f)
+		{
+			p.v(0) *= BOUND_DAMPING;
+			p.x(0) = EPS;
+		}
+		if(p.x(0)+EPS > VIEW_WIDTH) 
+		{
+			p.v(0) *= BOUND_DAMPING;
+			p.x(0) = VIEW_WIDTH-EPS;
+		}
+	}
+	if(c.walls && c.period.y <= 0.0)
+	{
+		if(p.x(1)-EPS < 0.0f)
+		{
+			p.v(1) *= BOUND_DAMPING;
+			p.x(1) = EPS;
+		}
+		if(p.x(1)+EPS > VIEW_HEIGHT)
+		{
+			p.v(1) *= BOUND_DAMPING;
+			p.x(1) = VIEW_HEIGHT-EPS;
+		}
+	}
+
+	// periodic axes wrap back into the domain
+	if(c.period.x > 0.0) p.x(0) -= c.period.x * floor(p.x(0) / c.period.x);
+	if(c.period.y > 0.0) p.x(1) -= c.period.y * floor(p.x(1) / c.period.y);
+
+	// push particles out of obstacle walls and damp the normal velocity
+	up::WallContact contact;
+	if(!obstacles.empty() && obstacles.bvh.closest(up::Vec2(p.x(0), p.x(1)), OBSTACLE_EPS, contact))
+	{
+		Vector2d n(contact.normal.x, contact.normal.y);
+		Vector2r nr = n.cast<Real>();
+		p.x = Vector2d(contact.point.x, contact.point.y) + OBSTACLE_EPS * n;
+
+		Real vn = p.v.dot(nr);
+		if(vn < 0.0) p.v -= Real(1.0 - BOUND_DAMPING) * vn * nr;
+	}
+}
+
+void UpdatePositionVelocity(Simulation& sim)
+{
+	ScopedTimer timer(PHASE_INTEGRATION);
+
+	const IntegrationConstants constants(sim.params, sim.dt);
+	const up::Obstacles& obstacles = sim.obstacles;
+	const uint8_t* asleep = SleepMask(sim);
+	const double SLEEP_SPEED2 = double(sim.params.sleepSpeed) * sim.params.sleepSpeed;
+	const NeighborGrid& grid = sim.grid;
+	vector<Particle>& particles = sim.particles;
+
+	ParallelFor(sim.pool, OwnedCount(sim), "integration", [&](size_t begin, size_t end)
+	{
+		for(size_t i = begin; i < end; i++)
+		{
+			Particle& p = particles[i];
+			if(p.isBoundary) continue;
+			if(asleep && asleep[grid.cellOf(i)]) continue;
+
+			IntegrateParticle(constants, obstacles, p);
+
+			if(!asleep) continue;
+			if(p.v.squaredNorm() < SLEEP_SPEED2) p.quietSteps += p.quietSteps < UINT16_MAX;
+			else p.quietSteps = 0;
+		}
+	});
+}
+
+// Buckets the particles into cells of the kernel support, 2*H wide, which
+// is the widest of all level pairs, after closing the holes left by
+// removed particles
+void NeighborSearch(Simulation& sim)
+{
+	ScopedTimer timer(PHASE_NEIGHBORS);
+
+	CompactParticles(sim);
+
+	// periodic axes start every build inside the period, like the grid
+	const GridPeriod period = DomainPeriod(sim.params);
+	if(period.any())
+		for(Particle& p : sim.particles)
+		{
+			if(period.x > 0.0) p.x(0) -= period.x * floor(p.x(0) / period.x);
+			if(period.y > 0.0) p.x(1) -= period.y * floor(p.x(1) / period.y);
+		}
+
+	const vector<Particle>& particles = sim.particles;
+	sim.grid.build(particles.size(), sim.kernel.support, [&particles](size_t i) -> const Vector2d& { return particles[i].x; }, period);
+	AssignCells(sim);
+}
+
+void UpdateSleep(Simulation& sim)
+{
+	sim.sleepingCount = 0;
+	if(sim.params.sleepSpeed <= 0.f) return;
+
+	const NeighborGrid& grid = sim.grid;
+	const vector<Particle>& particles = sim.particles;
+	const vector<uint32_t>& cellStart = grid.cellStart();
+	const vector<uint32_t>& sorted = grid.sorted();
+	const uint16_t SLEEP_STEPS = sim.params.sleepSteps;
+
+	GrowCapacity(sim.cellQuiet, grid.cellCount());
+	GrowCapacity(sim.cellAsleep, grid.cellCount());
+	sim.cellQuiet.assign(grid.cellCount(), 1);
+	sim.cellAsleep.assign(grid.cellCount(), 0);
+
+	for(size_t c = 0; c < grid.cellCount(); c++)
+		for(uint32_t k = cellStart[c]; k < cellStart[c + 1]; k++)
+		{
+			const Particle& p = particles[sorted[k]];
+			if(!p.isBoundary && p.quietSteps < SLEEP_STEPS)
+			{
+				sim.cellQuiet[c] = 0;
+				break;
+			}
+		}
+
+	for(uint32_t c = 0; c < grid.cellCount(); c++)
+	{
+		bool quiet = true;
+		grid.forEachNeighborRange(c, [&](uint32_t first, uint32_t end)
+		{
+			for(uint32_t n = first; quiet && n < end; n++) quiet = sim.cellQuiet[n] != 0;
+		});
+		if(!quiet) continue;
+
+		sim.cellAsleep[c] = 1;
+		for(uint32_t k = cellStart[c]; k < cellStart[c + 1]; k++)
+			sim.sleepingCount += !particles[sorted[k]].isBoundary;
+	}
+}
+
+float KernelFunction(const Kernel& kernel, float distance)
+{
+	float q = distance/kernel.h;
+	float alpha = kernel.alpha;
+	float t1 = max(1-q, 0.f);
+	float t2 = max(2-q, 0.f);
+
+	if(0 <= q && q < 1) {
+		return alpha * (t2*t2*t2 - 4*t1*t1*t1);
+	} else if(1 <= q && q < 2){
+		return alpha * t2*t2*t2;
+	}
+	else return 0;
+}
+
+Vector2r KernelFirstDerivativeFunction(const Kernel& kernel, Vector2r normalizedDistance, float distance)
+{
+	float q = distance/kernel.h;
+	Vector2r derivQ = normalizedDistance*kernel.h;
+	float alpha = kernel.alpha;
+	float t1 = max(1-q, 0.f);
+	float t2 = max(2-q, 0.f);
+
+	if(0 <= q && q < 1) {
+		return alpha * derivQ * (-3 * t2 * t2 - 12 * t1 * t1);
+	} else if(1 <= q && q < 2){
+		return alpha * derivQ * -3 * t2 * t2;
+	}
+	else return Vector2r(0.f,0.f);
+}
+
+void CalculateDensityPressure(Simulation& sim)
+{
+	ScopedTimer timer(PHASE_DENSITY);
+
+	const Kernel* kernels = sim.pairKernels.data();
+	const float* levelMass = sim.levelMass.data();
+	const size_t LEVELS = sim.levelMass.size();
+	const bool VARIABLE = LEVELS > 1;	// lets single level runs skip the lookups
+	const GridPeriod period = sim.grid.period();
+	const float REST_DENS = sim.params.restDens;
+	const float STIFFNESS = sim.params.stiffness;
+	const EquationOfState EOS = sim.params.eos;
+	const float SLEEP_DENSITY = sim.params.sleepDensity * REST_DENS;
+	const uint8_t* asleep = SleepMask(sim);
+	vector<Particle>& particles = sim.particles;
+	const NeighborGrid& grid = sim.grid;
+
+	// Boundary particles take the pressure of the last fluid particle in
+	// range, before any fluid pressure is updated. Gathering it here keeps
+	// the fluid loop free of writes to other particles.
+	ParallelFor(sim.pool, OwnedCount(sim), "boundary pressure", [&](size_t begin, size_t end)
+	{
+		for(size_t i = begin; i < end; i++)
+		{
+			Particle& pi = particles[i];
+			if(!pi.isBoundary) continue;
+			const bool wrap = grid.wraps(i);
+
+			int64_t last = -1;
+			grid.forEachNeighbor(i, [&](uint32_t j)
+			{
+				const Particle& pj = particles[j];
+				Vector2d rij = pj.x - pi.x;
+				if(wrap) period.wrap(rij);
+				if(!pj.isBoundary && rij.norm() < kernels[pi.level * LEVELS + pj.level].support) last = max<int64_t>(last, j);
+			});
+			if(last >= 0) pi.p = particles[last].p;
+		}
+	});
+
+	ParallelForParticles(sim, "density", false, [&](size_t i)
+    {
+		Particle& pi = particles[i];
+		if(pi.isBoundary) return;
+		if(asleep && asleep[grid.cellOf(i)]) return;
+		const bool wrap = grid.wraps(i);
+		
+		DensitySum rho;
+		grid.forEachNeighbor(i, [&](uint32_t j)
+		{
+			const Particle& pj = particles[j];
+			Vector2d rij = pj.x - pi.x;
+			if(wrap) period.wrap(rij);
+			float dist = rij.norm();
+
+			const Kernel& kernel = kernels[VARIABLE ? pi.level * LEVELS + pj.level : 0];
+			if(dist < kernel.support) rho.add(levelMass[VARIABLE ? pj.level : 0] * KernelFunction(kernel, dist));
+		});
+		if(asleep && fabs(rho.value() - pi.rho) > SLEEP_DENSITY) pi.quietSteps = 0;
+		pi.rho = rho.value();
+		
+		if(EOS == EquationOfState::Tait) pi.p = max(STIFFNESS/7 * (pow(pi.rho/REST_DENS, 7.f) - 1), 0.0f);
+		else pi.p = max(STIFFNESS*(pi.rho/REST_DENS - 1), 0.0f);
+    });
+}
+
+void CalculateForces(Simulation& sim)
+{
+	ScopedTimer timer(PHASE_FORCES);
+
+	const Kernel* kernels = sim.pairKernels.data();
+	const float* levelMass = sim.levelMass.data();
+	const size_t LEVELS = sim.levelMass.size();
+	const bool VARIABLE = LEVELS > 1;	// lets single level runs skip the lookups
+	const GridPeriod period = sim.grid.period();
+	const float VISC = sim.params.visc;
+	const Vector2r G = sim.params.gravity.cast<Real>();
+	const uint8_t* asleep = SleepMask(sim);
+	vector<Particle>& particles = sim.particles;
+	const NeighborGrid& grid = sim.grid;
+
+	ParallelForParticles(sim, "forces", true, [&](size_t i)
+    {
+		Particle& pi = particles[i];
+		if(pi.isBoundary) return;
+		if(asleep && asleep[grid.cellOf(i)]) return;
+		const bool wrap = grid.wraps(i);
+
+        ForceSum fpress;
+        ForceSum fvisc;
+
+        grid.forEachNeighbor(i, [&](uint32_t j)
+        {
+			const Particle& pj = particles[j];
+			// offsets are taken between double positions, then narrowed
+			Vector2d offset = pj.x - pi.x;
+			if(wrap) period.wrap(offset);
+        	Vector2r rij = offset.cast<Real>();
+
+			Vector2r xij = -rij;
+			Vector2r vij = pi.v - pj.v;
+            
+			float distance = rij.norm();
+
+			const Kernel& kernel = kernels[VARIABLE ? pi.level * LEVELS + pj.level : 0];
+			const float H = kernel.h;
+			const float MASS = levelMass[VARIABLE ? pj.level : 0];
+            if(distance < kernel.support)
+            {
+                // compute pressure force contribution
+                fpress.add(Real(-MASS * (pi.p/pow(pi.rho,2) + pj.p/pow(pj.rho,2))) * KernelFirstDerivativeFunction(kernel, rij.normalized(), distance));
+
+                // compute viscosity force contribution (non-pressure acceleration)
+                fvisc.add(Real(MASS / pj.rho * ( vij.dot(xij) / (xij.dot(xij)+0.01f*H*H) )) * KernelFirstDerivativeFunction(kernel, rij.normalized(), distance));
+            }
+        });
+
+		//Sum non-pressure accelerations and pressure accelerations
+        pi.f = fpress.value() + 2*VISC * fvisc.value() + G;
+    });
+
+	RebalanceCells(sim);
+}
+
+void Step(Simulation& sim)
+{
+	ArenaScope scratch(sim.scratch);
+
+	ApplyEmittersAndSinks(sim);
+	NeighborSearch(sim);
+	UpdateSleep(sim);
+	CalculateDensityPressure(sim);
+	CalculateForces(sim);
+	UpdatePositionVelocity(sim);
+	AdaptResolution(sim);
+
+	sim.stepCount++;
+	sim.simTime += sim.dt;
+}
+
+SimDiagnostics Diagnose(const Simulation& sim)
+{
+	const vector<float>& levelMass = sim.levelMass;
+	const vector<Particle>& particles = sim.particles;
+
+	SimDiagnostics sum = ParallelReduce(sim.pool, OwnedCount(sim), SimDiagnostics(),
+		[&](size_t begin, size_t end)
+		{
+			SimDiagnostics d;
+			for (size_t i = begin; i < end; i++)
+			{
+				const Particle& p = particles[i];
+				if (p.isBoundary) continue;
+
+				if (!p.x.allFinite() || !p.v.allFinite() || !std::isfinite(p.rho)) d.finite = false;
+
+				double speed = p.v.norm();
+				d.fluidCount++;
+				d.kineticEnergy += 0.5 * levelMass[p.level] * speed * speed;
+				d.meanDensity += p.rho;
+				d.maxDensity = max(d.maxDensity, double(p.rho));
+				d.maxSpeed = max(d.maxSpeed, speed);
+			}
+			return d;
+		},
+		[](const SimDiagnostics& a, const SimDiagnostics& b)
+		{
+			SimDiagnostics d;
+			d.fluidCount = a.fluidCount + b.fluidCount;
+			d.kineticEnergy = a.kineticEnergy + b.kineticEnergy;
+			d.meanDensity = a.meanDensity + b.meanDensity;
+			d.maxDensity = max(a.maxDensity, b.maxDensity);
+			d.maxSpeed = max(a.maxSpeed, b.maxSpeed);
+			d.finite = a.finite && b.finite;
+			return d;
+		}, "diagnostics");
+
+	if (sum.fluidCount) sum.meanDensity /= sum.fluidCount;
+	return sum;
+}
+
+static void HashBytes(uint64_t& hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+}
+
+uint64_t StateHash(const Simulation& sim)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < OwnedCount(sim); i++)
+	{
+		const Particle& p = sim.particles[i];
+		HashBytes(hash, p.x.data(), 2 * sizeof(double));
+		HashBytes(hash, p.v.data(), 2 * sizeof(Real));
+		HashBytes(hash, &p.rho, sizeof(p.rho));
+		HashBytes(hash, &p.p, sizeof(p.p));
+	}
+	return hash;
+}
@@ -0,0 +1,351 @@
+#include "sph.hpp"
+#include "scene.hpp"
+#include "snapshot.hpp"
+#include "text_writer.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Parameter sweeps. Every combination of the --vary values runs as its own
+// headless simulation of the base scene. All runs share this process and one
+// thread pool; each run is serial, so --jobs is the number of simulations in
+// flight. Results go to one directory per run plus summary.csv.
+
+// One swept scene key and the values it takes
+struct SweepAxis
+{
+	string key;
+	vector<string> values;
+};
+
+struct RunResult
+{
+	vector<string> values;		// one per axis
+	uint64_t steps = 0;
+	double seconds = 0.0;
+	double meanDensity = 0.0;	// over the fluid particles at the last step
+	double maxDensity = 0.0;
+	double maxSpeed = 0.0;
+	uint64_t stateHash = 0;		// StateHash of the last step
+	bool diverged = false;
+	string error;
+};
+
+// How often a run checks for blow-ups, in steps
+const static uint64_t DIVERGENCE_CHECK_EVERY = 100;
+
+// "visc=1,2,5" lists the values, "visc=1:5:0.5" is first:last:step
+static bool ParseAxis(const string& spec, SweepAxis& axis, string& error)
+{
+	size_t eq = spec.find('=');
+	if (eq == string::npos || eq == 0 || eq + 1 == spec.size())
+	{
+		error = "expected key=values, got \"" + spec + "\"";
+		return false;
+	}
+
+	axis.key = spec.substr(0, eq);
+	string values = spec.substr(eq + 1);
+
+	double first, last, step;
+	char c1, c2, rest;
+	if (sscanf(values.c_str(), "%lf%c%lf%c%lf%c", &first, &c1, &last, &c2, &step, &rest) == 5 && c1 == ':' && c2 == ':')
+	{
+		if (step <= 0.0 || last < first)
+		{
+			error = "empty range in \"" + spec + "\"";
+			return false;
+		}
+
+		// count the steps up front so rounding cannot drop the last value
+		long count = lround(floor((last - first) / step + 1e-9)) + 1;
+		for (long i = 0; i < count; i++)
+		{
+			ostringstream value;
+			value << setprecision(9) << first + i * step;
+			axis.values.push_back(value.str());
+		}
+	}
+	else
+	{
+		istringstream ss(values);
+		string value;
+		while (getline(ss, value, ','))
+			if (!value.empty()) axis.values.push_back(value);
+	}
+
+	if (axis.values.empty())
+	{
+		error = "no values in \"" + spec + "\"";
+		return false;
+	}
+	return true;
+}
+
+// Axis values of run index, the last axis varying fastest
+static vector<string> RunValues(const vector<SweepAxis>& axes, size_t index)
+{
+	vector<string> values(axes.size());
+	for (size_t a = axes.size(); a-- > 0;)
+	{
+		values[a] = axes[a].values[index % axes[a].values.size()];
+		index /= axes[a].values.size();
+	}
+	return values;
+}
+
+static bool MakeDirectory(const string& path, string& error)
+{
+	if (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST) return true;
+
+	error = "cannot create " + path + ": " + strerror(errno);
+	return false;
+}
+
+// Density and speed statistics of the fluid, false if any of it is not finite
+static bool Measure(const Simulation& sim, RunResult& result)
+{
+	SimDiagnostics d = Diagnose(sim);
+
+	result.meanDensity = d.meanDensity;
+	result.maxDensity = d.maxDensity;
+	result.maxSpeed = d.maxSpeed;
+	result.stateHash = StateHash(sim);
+	return d.finite;
+}
+
+static void WriteFrame(SnapshotWriter& writer, const Simulation& sim, SnapshotFrame& frame)
+{
+	frame.step = sim.stepCount;
+	frame.time = sim.simTime;
+	frame.resize(sim.particles.size());
+
+	for (size_t i = 0; i < frame.size(); i++)
+	{
+		const Particle& pi = sim.particles[i];
+		frame.x[i] = pi.x(0);
+		frame.y[i] = pi.x(1);
+		frame.vx[i] = pi.v(0);
+		frame.vy[i] = pi.v(1);
+		frame.rho[i] = pi.rho;
+		frame.p[i] = pi.p;
+		frame.flags[i] = pi.isBoundary ? SNAP_FLAG_BOUNDARY : 0;
+	}
+
+	writer.write(frame);
+}
+
+// Runs one point of the grid to completion in dir. With writeFrames, every
+// scene.outputEvery-th step goes to dir/frames.fsnap.
+static void Run(const Scene& base, const vector<SweepAxis>& axes, const string& dir, uint64_t steps, bool writeFrames, RunResult& result)
+{
+	TraceScope trace("sweep run");
+
+	Scene scene = base;
+	for (size_t a = 0; a < axes.size(); a++)
+		if (!SetSceneValue(scene, axes[a].key, result.values[a], result.error)) return;
+
+	if (!MakeDirectory(dir, result.error)) return;
+
+	// the applied settings, loadable as a scene on top of the base one
+	ofstream settings(dir + "/settings.scene");
+	for (size_t a = 0; a < axes.size(); a++) settings << axes[a].key << " " << result.values[a] << "\n";
+	settings.close();
+
+	SnapshotWriter frames;
+	SnapshotFrame frame;
+	if (writeFrames && !frames.open(dir + "/frames.fsnap"))
+	{
+		result.error = "cannot open " + dir + "/frames.fsnap";
+		return;
+	}
+
+	Simulation sim;
+	SetupSimulation(sim, scene);
+
+	auto start = chrono::steady_clock::now();
+	while (sim.stepCount < steps)
+	{
+		Step(sim);
+
+		if (writeFrames && sim.stepCount % scene.outputEvery == 0) WriteFrame(frames, sim, frame);
+		if (sim.stepCount % DIVERGENCE_CHECK_EVERY == 0 && !Measure(sim, result))
+		{
+			result.diverged = true;
+			break;
+		}
+	}
+	result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	result.steps = sim.stepCount;
+
+	if (!result.diverged && !Measure(sim, result)) result.diverged = true;
+}
+
+static const char* Status(const RunResult& result)
+{
+	if (!result.error.empty()) return "error";
+	return result.diverged ? "diverged" : "ok";
+}
+
+static void WriteSummary(ostream& stream, const vector<SweepAxis>& axes, const vector<RunResult>& results)
+{
+	// the digits ostream's default notation writes
+	const int DIGITS = 6;
+
+	TextWriter out(stream);
+	out << "run";
+	for (const SweepAxis& axis : axes) out << "," << axis.key;
+	out << ",steps,seconds,ms_per_step,mean_density,max_density,max_speed,state_hash,status\n";
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const RunResult& r = results[i];
+		out << i;
+		for (const string& value : r.values) out << "," << value;
+		out << "," << r.steps << "," << Significant(r.seconds, DIGITS) << "," << Significant(r.steps ? 1e3 * r.seconds / r.steps : 0.0, DIGITS)
+			<< "," << Significant(r.meanDensity, DIGITS) << "," << Significant(r.maxDensity, DIGITS) << "," << Significant(r.maxSpeed, DIGITS)
+			<< "," << Hex(r.stateHash) << "," << Status(r) << "\n";
+	}
+}
+
+int main(int argc, char** argv)
+{
+	string scenePath = "../res/default.scene";
+	string outDir = "sweep";
+	vector<string> overrides;
+	vector<SweepAxis> axes;
+	uint64_t steps = 1000;
+	unsigned jobs = max(1u, thread::hardware_concurrency());
+	bool writeFrames = false;
+	string error;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--scene" && i + 1 < argc) scenePath = argv[++i];
+		else if (arg == "--set" && i + 1 < argc) overrides.push_back(argv[++i]);
+		else if (arg == "--vary" && i + 1 < argc)
+		{
+			SweepAxis axis;
+			if (!ParseAxis(argv[++i], axis, error))
+			{
+				cout << error << endl;
+				return 1;
+			}
+			axes.push_back(axis);
+		}
+		else if (arg == "--steps" && i + 1 < argc) steps = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--jobs" && i + 1 < argc) jobs = max(1ul, strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--out" && i + 1 < argc) outDir = argv[++i];
+		else if (arg == "--frames") writeFrames = true;
+		else {
+			cout << "Usage: " << argv[0] << " --vary key=v1,v2,... | --vary key=first:last:step [--vary ...]"
+				" [--scene file] [--set key=value]... [--steps n] [--jobs n] [--out dir] [--frames]" << endl;
+			return 1;
+		}
+	}
+
+	if (axes.empty())
+	{
+		cout << "Nothing to sweep, give at least one --vary" << endl;
+		return 1;
+	}
+
+	Scene base;
+	SceneLoad sceneLoad = LoadScene(scenePath, base, error);
+	if (sceneLoad == SceneLoad::Missing) cout << "Using the default scene: " << error << endl;
+	else if (sceneLoad == SceneLoad::Invalid)
+	{
+		cout << error << endl;
+		return 1;
+	}
+
+	for (const string& assignment : overrides)
+	{
+		if (!SetSceneOverride(base, assignment, error))
+		{
+			cout << error << endl;
+			return 1;
+		}
+	}
+
+	// catch typos before starting anything
+	for (const SweepAxis& axis : axes)
+	{
+		for (const string& value : axis.values)
+		{
+			Scene check = base;
+			if (!SetSceneValue(check, axis.key, value, error))
+			{
+				cout << error << endl;
+				return 1;
+			}
+		}
+	}
+
+	if (!MakeDirectory(outDir, error))
+	{
+		cout << error << endl;
+		return 1;
+	}
+
+	size_t runs = 1;
+	for (const SweepAxis& axis : axes) runs *= axis.values.size();
+
+	vector<RunResult> results(runs);
+	for (size_t i = 0; i < runs; i++) results[i].values = RunValues(axes, i);
+
+	cout << "Sweeping " << runs << " runs of " << steps << " steps, " << jobs << " at a time" << endl;
+
+	// one chunk per pool thread, each pulling runs until none are left, so
+	// slow runs do not hold up a whole statically assigned share
+	ThreadPool pool(jobs);
+	atomic<size_t> next(0);
+	atomic<size_t> finished(0);
+	mutex coutMutex;
+
+	pool.parallelFor(pool.size(), [&](size_t, size_t)
+	{
+		for (size_t run; (run = next++) < runs;)
+		{
+			char name[32];
+			snprintf(name, sizeof(name), "/run_%04zu", run);
+
+			RunResult& result = results[run];
+			Run(base, axes, outDir + name, steps, writeFrames, result);
+
+			lock_guard<mutex> lock(coutMutex);
+			cout << "[" << ++finished << "/" << runs << "] run " << run << ":";
+			for (size_t a = 0; a < axes.size(); a++) cout << " " << axes[a].key << "=" << result.values[a];
+			cout << "  " << Status(result);
+			if (!result.error.empty()) cout << " (" << result.error << ")";
+			cout << endl;
+		}
+	}, "sweep");
+
+	ofstream summary(outDir + "/summary.csv");
+	WriteSummary(summary, axes, results);
+	summary.close();
+
+	cout << "Summary written to " << outDir << "/summary.csv" << endl;
+	return 0;
+}
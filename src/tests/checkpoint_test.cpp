@@ -0,0 +1,61 @@
+#include "checkpoint.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Saves a checkpoint and maps it back with CheckpointReader, which must
+// see exactly what was saved
+
+static int failures = 0;
+
+static void Check(bool condition, const string& what)
+{
+	if (condition) return;
+	cout << "FAILED: " << what << endl;
+	failures++;
+}
+
+int main()
+{
+	const string PATH = "checkpoint_test.ckpt";
+
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	header.stepCount = 1234;
+	header.simTime = 12.34;
+
+	vector<CheckpointParticle> particles(5);
+	memset(particles.data(), 0, particles.size() * sizeof(CheckpointParticle));
+	for (size_t i = 0; i < particles.size(); i++)
+	{
+		particles[i].x[0] = 10.0 * i;
+		particles[i].x[1] = -1.0 * i;
+		particles[i].rho = 1.0f + i;
+		particles[i].quietSteps = static_cast<uint32_t>(i);
+	}
+	vector<CheckpointEmitter> emitters = { { 7, 3, 0.25 } };
+
+	string error;
+	Check(SaveCheckpoint(PATH, header, particles, emitters, error), "save: " + error);
+
+	CheckpointReader reader;
+	error = "left over from an earlier call";
+	Check(reader.open(PATH, error), "open the reader with a non-empty error string");
+	Check(reader.header().stepCount == 1234 && reader.header().simTime == 12.34, "header read back");
+	Check(reader.header().particleCount == particles.size() && reader.header().emitterCount == emitters.size(), "counts read back");
+	if (reader.header().particleCount == particles.size())
+		Check(memcmp(reader.particles(), particles.data(), particles.size() * sizeof(CheckpointParticle)) == 0, "particles read back");
+	if (reader.header().emitterCount == emitters.size())
+		Check(memcmp(reader.emitters(), emitters.data(), sizeof(CheckpointEmitter)) == 0, "emitters read back");
+	reader.close();
+
+	remove(PATH.c_str());
+
+	if (failures == 0) cout << "checkpoint round trip passed" << endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+#include "scene.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// A scene file with a bad line must leave the scene untouched and say it
+// is invalid, not missing
+
+static int failures = 0;
+
+static void Check(bool condition, const string& what)
+{
+	if (condition) return;
+	cout << "FAILED: " << what << endl;
+	failures++;
+}
+
+static void WriteFile(const string& path, const string& text)
+{
+	ofstream file(path, ios::trunc);
+	file << text;
+}
+
+int main()
+{
+	const string PATH = "scene_test.scene";
+	const Scene DEFAULT;
+	string error;
+
+	WriteFile(PATH, "fluid 200 316 260 400 20\nvsic 3\n");
+	Scene scene;
+	Check(LoadScene(PATH, scene, error) == SceneLoad::Invalid, "a bad line is invalid");
+	Check(scene.fluid.size() == DEFAULT.fluid.size() && scene.fluid[0].maxCount == DEFAULT.fluid[0].maxCount,
+		"the lines before the bad one are not applied");
+
+	WriteFile(PATH, "fluid 200 316 260 400 20\nvisc 3\n");
+	Check(LoadScene(PATH, scene, error) == SceneLoad::Loaded, "a good file loads: " + error);
+	Check(scene.fluid.size() == 1 && scene.fluid[0].maxCount == 20 && scene.params.visc == 3.f, "a good file is applied");
+
+	remove(PATH.c_str());
+	Check(LoadScene(PATH, scene, error) == SceneLoad::Missing, "a missing file is missing");
+
+	if (failures == 0) cout << "scene loading passed" << endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#include "snapshot.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Writes a few frames with SnapshotWriter and reads them back with
+// SnapshotReader, which must see exactly what was written
+
+static int failures = 0;
+
+static void Check(bool condition, const string& what)
+{
+	if (condition) return;
+	cout << "FAILED: " << what << endl;
+	failures++;
+}
+
+static SnapshotFrame MakeFrame(uint64_t step, size_t n)
+{
+	SnapshotFrame frame;
+	frame.step = step;
+	frame.time = 0.01 * step;
+	frame.resize(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		float v = static_cast<float>(step * 1000 + i);
+		frame.x[i] = v;
+		frame.y[i] = -v;
+		frame.vx[i] = 0.5f * v;
+		frame.vy[i] = 0.25f * v;
+		frame.rho[i] = 1.0f + v;
+		frame.p[i] = 2.0f * v;
+		frame.flags[i] = i % 3 == 0 ? SNAP_FLAG_BOUNDARY : 0;
+	}
+	return frame;
+}
+
+static bool SameFrame(const SnapshotFrame& a, const SnapshotView& b)
+{
+	if (a.step != b.step || a.time != b.time || a.size() != b.count) return false;
+	for (size_t i = 0; i < b.count; i++)
+	{
+		if (a.x[i] != b.x[i] || a.y[i] != b.y[i] || a.vx[i] != b.vx[i] || a.vy[i] != b.vy[i] ||
+			a.rho[i] != b.rho[i] || a.p[i] != b.p[i] || a.flags[i] != b.flags[i])
+			return false;
+	}
+	return true;
+}
+
+int main()
+{
+	const string PATH = "snapshot_test.snap";
+
+	// odd sizes, so the blocks need padding, and an empty frame
+	const size_t SIZES[] = { 7, 0, 163 };
+	vector<SnapshotFrame> frames;
+	for (size_t k = 0; k < 3; k++) frames.push_back(MakeFrame(k * 10, SIZES[k]));
+
+	{
+		SnapshotWriter writer;
+		Check(writer.open(PATH), "open the writer");
+		for (const SnapshotFrame& frame : frames) Check(writer.write(frame), "write a frame");
+		writer.close();
+	}
+
+	SnapshotReader reader;
+	string error = "left over from an earlier call";
+	Check(reader.open(PATH, error), "open the reader with a non-empty error string");
+	Check(reader.frameCount() == frames.size(), "frame count");
+	for (size_t k = 0; k < frames.size() && k < reader.frameCount(); k++)
+		Check(SameFrame(frames[k], reader.frame(k)), "frame " + to_string(k) + " read back");
+	reader.close();
+
+	error.clear();
+	Check(!reader.open(PATH + ".missing", error) && !error.empty(), "a missing file fails with a message");
+
+	remove(PATH.c_str());
+
+	if (failures == 0) cout << "snapshot round trip passed" << endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+#include "text_writer.hpp"
+#include "utils.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace std;
+
+// The formatters must write the digits printf writes, above all for
+// values a hair off a rounding tie, where only the exact product decides
+
+static int failures = 0;
+
+static void Check(bool condition, const string& what)
+{
+	if (condition) return;
+	cout << "FAILED: " << what << endl;
+	failures++;
+}
+
+static string Fixed(double value, int decimals)
+{
+	char text[FORMAT_MAX];
+	return string(text, FormatFixed(text, value, decimals));
+}
+
+static string Significant(double value, int digits)
+{
+	char text[FORMAT_MAX];
+	return string(text, FormatSignificant(text, value, digits));
+}
+
+static string Printf(const char* format, int precision, double value)
+{
+	char text[FORMAT_MAX];
+	snprintf(text, sizeof(text), format, precision, value);
+	return text;
+}
+
+static void CheckFixed(double value, int decimals)
+{
+	string expected = Printf("%.*f", decimals, value);
+	if (expected.find_first_not_of("-0.") == string::npos && expected[0] == '-') expected.erase(0, 1);
+	string text = Fixed(value, decimals);
+	Check(text == expected, "FormatFixed(" + Printf("%.*g", 17, value) + ", " + to_string(decimals) + ") wrote " + text + ", printf " + expected);
+}
+
+static void CheckSignificant(double value, int digits)
+{
+	string expected = Printf("%.*g", digits, value);
+	string text = Significant(value, digits);
+	Check(text == expected, "FormatSignificant(" + Printf("%.*g", 17, value) + ", " + to_string(digits) + ") wrote " + text + ", printf " + expected);
+}
+
+int main()
+{
+	// stored a little above the tie, so they round up
+	Check(Fixed(0.05, 1) == "0.1", "0.05 at 1 decimal is 0.1");
+	Check(Fixed(0.0005, 3) == "0.001", "0.0005 at 3 decimals is 0.001");
+	Check(round(0.05, 1) == "0.1", "round(0.05, 1) is 0.1");
+	Check(Significant(0.05, 1) == "0.05", "0.05 with 1 digit is 0.05");
+	Check(Significant(0.0005, 1) == "0.0005", "0.0005 with 1 digit is 0.0005");
+
+	// stored a little below the tie, so they round down
+	Check(Fixed(0.15, 1) == "0.1", "0.15 at 1 decimal is 0.1");
+	Check(Fixed(2.675, 2) == "2.67", "2.675 at 2 decimals is 2.67");
+
+	// exact ties go to even
+	Check(Fixed(0.5, 0) == "0" && Fixed(1.5, 0) == "2" && Fixed(2.5, 0) == "2", "exact ties round to even");
+	Check(Fixed(0.125, 2) == "0.12" && Fixed(0.375, 2) == "0.38", "exact ties round to even after the point");
+	Check(Fixed(-0.04, 1) == "0.0", "negative zero prints without its sign");
+
+	// every tie k.5 / 10^decimals, as the nearest double lands on either side
+	for (int decimals = 0; decimals <= FORMAT_MAX_DECIMALS; decimals++)
+		for (int k = 0; k < 2000; k++)
+		{
+			double tie = k + 0.5;
+			for (int d = 0; d < decimals; d++) tie /= 10;
+			CheckFixed(tie, decimals);
+			CheckFixed(-tie, decimals);
+			CheckFixed(nextafter(tie, 0.0), decimals);
+			CheckFixed(nextafter(tie, 1.0), decimals);
+			CheckSignificant(tie, decimals + 1);
+		}
+
+	char hex[FORMAT_MAX];
+	Check(string(hex, FormatHex(hex, 0x2de89b608cbb5fbaull)) == "2de89b608cbb5fba", "FormatHex writes lowercase digits");
+	Check(string(hex, FormatHex(hex, 0xfull)) == "000000000000000f", "FormatHex keeps the leading zeros");
+
+	mt19937_64 generator(1);
+	uniform_real_distribution<double> exponent(-6.0, 8.0);
+	for (int i = 0; i < 200000; i++)
+	{
+		double value = pow(10.0, exponent(generator));
+		if (i & 1) value = -value;
+		CheckFixed(value, i % (FORMAT_MAX_DECIMALS + 1));
+		CheckSignificant(value, 1 + i % 9);
+	}
+
+	if (failures == 0) cout << "text_writer_test passed" << endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+#include "text_writer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// "00" to "99", so integers come out two digits per division
+static const char DIGIT_PAIRS[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const double POWERS_OF_TEN[FORMAT_MAX_DECIMALS + 1] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+// Scaled values below 2^52 take the integer path, where their fraction is
+// exact; past it printf does it
+static const double FIXED_LIMIT = 4503599627370496.0;
+
+// Rounding error of the product p = a * b, so a * b == p + error exactly
+static double ProductError(double a, double b, double p)
+{
+#ifdef FP_FAST_FMA
+	return std::fma(a, b, -p);
+#else
+	// Dekker's split into 26-bit halves. Without hardware FMA the compiler
+	// cannot contract these into fused operations.
+	const double SPLIT = 134217729.0;	// 2^27 + 1
+	double ca = SPLIT * a, cb = SPLIT * b;
+	double ah = ca - (ca - a), al = a - ah;
+	double bh = cb - (cb - b), bl = b - bh;
+	return ((ah * bh - p) + ah * bl + al * bh) + al * bl;
+#endif
+}
+
+// The digits of value written backwards from end, returning their start
+static char* DigitsBackwards(char* end, uint64_t value)
+{
+	while (value >= 100)
+	{
+		unsigned pair = static_cast<unsigned>(value % 100) * 2;
+		value /= 100;
+		*--end = DIGIT_PAIRS[pair + 1];
+		*--end = DIGIT_PAIRS[pair];
+	}
+	if (value >= 10)
+	{
+		unsigned pair = static_cast<unsigned>(value) * 2;
+		*--end = DIGIT_PAIRS[pair + 1];
+		*--end = DIGIT_PAIRS[pair];
+	}
+	else *--end = static_cast<char>('0' + value);
+	return end;
+}
+
+char* FormatUnsigned(char* out, uint64_t value)
+{
+	char digits[20];
+	char* start = DigitsBackwards(digits + sizeof(digits), value);
+	size_t length = digits + sizeof(digits) - start;
+	memcpy(out, start, length);
+	return out + length;
+}
+
+char* FormatInteger(char* out, int64_t value)
+{
+	if (value >= 0) return FormatUnsigned(out, static_cast<uint64_t>(value));
+	*out++ = '-';
+	return FormatUnsigned(out, 0 - static_cast<uint64_t>(value));
+}
+
+char* FormatHex(char* out, uint64_t value)
+{
+	const char DIGITS[] = "0123456789abcdef";
+	for (int i = 15; i >= 0; i--, value >>= 4) out[i] = DIGITS[value & 15];
+	return out + 16;
+}
+
+char* FormatFixed(char* out, double value, int decimals)
+{
+	decimals = std::min(std::max(decimals, 0), FORMAT_MAX_DECIMALS);
+
+	double magnitude = std::fabs(value);
+	double scaled = magnitude * POWERS_OF_TEN[decimals];
+	if (!(scaled < FIXED_LIMIT))
+	{
+		// huge, infinite or NaN
+		int length = snprintf(out, FORMAT_MAX, "%.*f", decimals, value);
+		return out + std::max(0, std::min(length, static_cast<int>(FORMAT_MAX) - 1));
+	}
+
+	// round the exact product half to even, as printf does. The product's
+	// error is under half an ulp of scaled, so it decides only where frac
+	// is 0 or exactly a half; added to frac it would be rounded away
+	uint64_t units = static_cast<uint64_t>(scaled);
+	double frac = scaled - units;
+	double err = ProductError(magnitude, POWERS_OF_TEN[decimals], scaled);
+	if (frac == 0.0 && err < 0.0)
+	{
+		// just below units, which is where it rounds back to
+		units--;
+		frac = 1.0;
+	}
+	if (frac > 0.5 || (frac == 0.5 && (err > 0.0 || (err == 0.0 && (units & 1))))) units++;
+
+	if (std::signbit(value) && units != 0) *out++ = '-';
+	if (decimals == 0) return FormatUnsigned(out, units);
+
+	// the fraction keeps its leading zeros
+	uint64_t scale = static_cast<uint64_t>(POWERS_OF_TEN[decimals]);
+	out = FormatUnsigned(out, units / scale);
+	*out++ = '.';
+	char* end = out + decimals;
+	char* start = DigitsBackwards(end, units % scale);
+	while (start > out) *--start = '0';
+	return end;
+}
+
+// Digits of the formatted number, not counting leading zeros
+static int SignificantDigits(const char* begin, const char* end)
+{
+	int count = 0;
+	for (const char* c = begin; c < end; c++)
+		if (*c >= '1' || (*c == '0' && count > 0)) count++;
+	return count;
+}
+
+char* FormatSignificant(char* out, double value, int digits)
+{
+	digits = std::max(digits, 1);
+
+	double magnitude = std::fabs(value);
+	if (std::isfinite(magnitude))
+	{
+		// printf's fixed style covers exponents -4 to digits - 1; the
+		// estimate from log10 can be one off, and rounding can carry into
+		// a new digit, so the count of written digits settles it
+		int exponent = magnitude == 0.0 ? 0 : static_cast<int>(std::floor(std::log10(magnitude)));
+		char* start = out + std::signbit(value);
+		for (int attempt = 0; attempt < 2; attempt++)
+		{
+			int decimals = digits - 1 - exponent;
+			if (exponent < -4 || decimals < 0 || decimals > FORMAT_MAX_DECIMALS) break;
+
+			char* end = FormatFixed(start, magnitude, decimals);
+			int count = SignificantDigits(start, end);
+			if (count != digits && magnitude != 0.0)
+			{
+				exponent += count > digits ? 1 : -1;
+				continue;
+			}
+
+			if (start > out) *out = '-';
+			if (decimals > 0)
+			{
+				while (end[-1] == '0') end--;
+				if (end[-1] == '.') end--;
+			}
+			return end;
+		}
+	}
+
+	// exponent notation, infinite or NaN
+	int length = snprintf(out, FORMAT_MAX, "%.*g", digits, value);
+	return out + std::max(0, std::min(length, static_cast<int>(FORMAT_MAX) - 1));
+}
+
+TextWriter::TextWriter(std::ostream& out, size_t bufferSize) :
+	m_out(out),
+	m_buffer(std::max(bufferSize, 2 * FORMAT_MAX))
+{}
+
+TextWriter::~TextWriter()
+{
+	flush();
+}
+
+void TextWriter::flush()
+{
+	if (m_used == 0) return;
+	m_out.write(m_buffer.data(), m_used);
+	m_used = 0;
+}
+
+void TextWriter::append(const char* text, size_t length)
+{
+	if (m_buffer.size() - m_used < length)
+	{
+		flush();
+		if (length > m_buffer.size())
+		{
+			m_out.write(text, length);
+			return;
+		}
+	}
+	memcpy(m_buffer.data() + m_used, text, length);
+	m_used += length;
+}
+
+TextWriter& TextWriter::operator<<(const char* text)
+{
+	append(text, strlen(text));
+	return *this;
+}
+
+TextWriter& TextWriter::operator<<(const std::string& text)
+{
+	append(text.data(), text.size());
+	return *this;
+}
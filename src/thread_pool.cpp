@@ -0,0 +1,78 @@
+#include "thread_pool.hpp"
+#include "numa.hpp"
+#include "trace.hpp"
+
+ThreadPool::ThreadPool(unsigned threads, bool pin)
+{
+	if (pin) PinCurrentThread(PinnedCpu(0, std::max(threads, 1u)));
+	for (unsigned i = 1; i < threads; i++) m_workers.emplace_back(&ThreadPool::run, this, i, pin ? PinnedCpu(i, threads) : -1);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_start.notify_all();
+
+	for (std::thread& worker : m_workers) worker.join();
+}
+
+void ThreadPool::runChunk(unsigned index)
+{
+	size_t n = size();
+	size_t begin = m_count * index / n;
+	size_t end = m_count * (index + 1) / n;
+
+	TraceScope trace(m_name);
+	if (begin < end) m_fn(m_job, begin, end);
+}
+
+void ThreadPool::dispatch(size_t count, RangeFn fn, const void* job, const char* name)
+{
+	if (m_workers.empty() || count < 2)
+	{
+		if (count > 0) fn(job, 0, count);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_fn = fn;
+		m_job = job;
+		m_name = name;
+		m_count = count;
+		m_pending = static_cast<unsigned>(m_workers.size());
+		m_generation++;
+	}
+	m_start.notify_all();
+
+	runChunk(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_pending == 0; });
+	m_job = nullptr;
+}
+
+void ThreadPool::run(unsigned index, int cpu)
+{
+	SetTraceThreadName("worker");
+	if (cpu >= 0) PinCurrentThread(cpu);
+
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_start.wait(lock, [&] { return m_stop || m_generation != seen; });
+		if (m_stop) break;
+		seen = m_generation;
+
+		lock.unlock();
+		runChunk(index);
+		lock.lock();
+
+		if (--m_pending == 0) m_done.notify_one();
+	}
+}
@@ -0,0 +1,120 @@
+#include "trace.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> g_tracing{false};
+
+struct TraceEvent
+{
+	const char* name;
+	int64_t ns;
+	char phase;		// 'B' or 'E'
+};
+
+struct TraceBuffer
+{
+	uint32_t tid;
+	const char* threadName = nullptr;
+	std::vector<TraceEvent> events;
+};
+
+static const size_t TRACE_RESERVE = 1 << 16;
+
+// Buffers outlive their threads so events of finished workers still get written
+static std::mutex traceMutex;
+static std::vector<std::unique_ptr<TraceBuffer>> traceBuffers;
+static const std::chrono::steady_clock::time_point traceStart = std::chrono::steady_clock::now();
+
+// A thread gets its buffer with its first event, so threads that never
+// record while tracing is on cost nothing but their name
+static thread_local TraceBuffer* threadBuffer = nullptr;
+static thread_local const char* threadName = nullptr;
+
+static TraceBuffer& LocalBuffer()
+{
+	if (!threadBuffer)
+	{
+		std::lock_guard<std::mutex> lock(traceMutex);
+		traceBuffers.emplace_back(new TraceBuffer());
+		threadBuffer = traceBuffers.back().get();
+		threadBuffer->tid = static_cast<uint32_t>(traceBuffers.size());
+		threadBuffer->threadName = threadName;
+		threadBuffer->events.reserve(TRACE_RESERVE);
+	}
+	return *threadBuffer;
+}
+
+static void Record(const char* name, char phase)
+{
+	int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceStart).count();
+	LocalBuffer().events.push_back(TraceEvent{ name, ns, phase });
+}
+
+void EnableTracing(bool enable)
+{
+	g_tracing.store(enable, std::memory_order_relaxed);
+}
+
+void TraceBegin(const char* name)
+{
+	Record(name, 'B');
+}
+
+void TraceEnd(const char* name)
+{
+	Record(name, 'E');
+}
+
+void SetTraceThreadName(const char* name)
+{
+	threadName = name;
+	if (threadBuffer) threadBuffer->threadName = name;
+}
+
+bool WriteChromeTrace(const std::string& path, std::string& error)
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open())
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(traceMutex);
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	file.setf(std::ios::fixed);
+	file.precision(3);
+
+	bool first = true;
+	for (const std::unique_ptr<TraceBuffer>& buffer : traceBuffers)
+	{
+		if (buffer->threadName)
+		{
+			file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+				<< ",\"args\":{\"name\":\"" << buffer->threadName << "\"}}";
+			first = false;
+		}
+
+		for (const TraceEvent& e : buffer->events)
+		{
+			file << (first ? "" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase
+				<< "\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":" << e.ns / 1000.0 << "}";
+			first = false;
+		}
+	}
+
+	file << "\n]}\n";
+
+	if (!file.good())
+	{
+		error = "cannot write " + path;
+		return false;
+	}
+	return true;
+}